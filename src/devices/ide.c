@@ -9,6 +9,7 @@
 #include "threads/io.h"
 #include "threads/interrupt.h"
 #include "threads/synch.h"
+#include "threads/workqueue.h"
 
 /* The code in this file is an interface to an ATA (IDE)
    controller.  It attempts to comply to [ATA-3]. */
@@ -50,6 +51,12 @@
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
 
+/* A command whose completion interrupt has not arrived after
+   IDE_TIMEOUT ticks is given up on and the channel reset.  It is
+   tried IDE_TRY_CNT times in all. */
+#define IDE_TIMEOUT (5 * TIMER_FREQ)
+#define IDE_TRY_CNT 3
+
 /* An ATA device. */
 struct ata_disk
   {
@@ -70,7 +77,12 @@ struct channel
     struct lock lock;           /* Must acquire to access the controller. */
     bool expecting_interrupt;   /* True if an interrupt is expected, false if
                                    any interrupt would be spurious. */
-    struct semaphore completion_wait;   /* Up'd by interrupt handler. */
+    struct semaphore completion_wait;   /* Up'd by ide_softirq(). */
+    unsigned completions;       /* Interrupts not yet passed on to
+                                   completion_wait. */
+    unsigned unexpected;        /* Unexpected interrupts not yet
+                                   reported. */
+    struct work report_work;    /* Reports unexpected interrupts. */
 
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
@@ -92,10 +104,13 @@ static void output_sector (struct channel *, const void *);
 
 static void wait_until_idle (const struct ata_disk *);
 static bool wait_while_busy (const struct ata_disk *);
+static bool wait_for_completion (struct channel *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
 static void interrupt_handler (struct intr_frame *);
+static softirq_func ide_softirq;
+static work_func report_unexpected;
 
 /* Initialize the disk subsystem and detect disks. */
 void
@@ -103,6 +118,7 @@ ide_init (void)
 {
   size_t chan_no;
 
+  softirq_register (SOFTIRQ_BLOCK, ide_softirq, "ide");
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,9 +139,12 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      lock_init_named (&c->lock, c->name);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->completions = 0;
+      c->unexpected = 0;
+      work_init (&c->report_work, report_unexpected, c);
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -273,8 +292,7 @@ identify_ata_device (struct ata_disk *d)
      into our buffer. */
   select_device_wait (d);
   issue_pio_command (c, CMD_IDENTIFY_DEVICE);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
+  if (!wait_for_completion (c) || !wait_while_busy (d))
     {
       d->is_ata = false;
       return;
@@ -346,10 +364,18 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  int try;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
+  for (try = 0; ; try++)
+    {
+      if (try == IDE_TRY_CNT)
+        PANIC ("%s: disk read timed out, sector=%"PRDSNu, d->name, sec_no);
+      select_sector (d, sec_no);
+      issue_pio_command (c, CMD_READ_SECTOR_RETRY);
+      if (wait_for_completion (c))
+        break;
+    }
   if (!wait_while_busy (d))
     PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
   input_sector (c, buffer);
@@ -366,13 +392,21 @@ ide_write (void *d_, block_sector_t sec_no, const void *buffer)
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+  int try;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  for (try = 0; ; try++)
+    {
+      if (try == IDE_TRY_CNT)
+        PANIC ("%s: disk write timed out, sector=%"PRDSNu, d->name, sec_no);
+      select_sector (d, sec_no);
+      issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
+      if (!wait_while_busy (d))
+        PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
+      output_sector (c, buffer);
+      if (wait_for_completion (c))
+        break;
+    }
   lock_release (&c->lock);
 }
 
@@ -479,6 +513,33 @@ wait_while_busy (const struct ata_disk *d)
   return false;
 }
 
+/* Waits up to IDE_TIMEOUT for the completion interrupt of the
+   command just issued on channel C.  If it does not come, resets
+   the channel, so that the command can be issued again, and
+   returns false. */
+static bool
+wait_for_completion (struct channel *c)
+{
+  enum intr_level old_level;
+
+  if (sema_down_timeout (&c->completion_wait, IDE_TIMEOUT))
+    return true;
+
+  printf ("%s: command timed out, resetting\n", c->name);
+
+  /* Forget the interrupt we were waiting for, in case it turns
+     up late. */
+  old_level = intr_disable ();
+  c->expecting_interrupt = false;
+  c->completions = 0;
+  while (sema_try_down (&c->completion_wait))
+    continue;
+  intr_set_level (old_level);
+
+  reset_channel (c);
+  return false;
+}
+
 /* Program D's channel so that D is now the selected disk. */
 static void
 select_device (const struct ata_disk *d)
@@ -514,14 +575,60 @@ interrupt_handler (struct intr_frame *f)
         if (c->expecting_interrupt) 
           {
             inb (reg_status (c));               /* Acknowledge interrupt. */
-            sema_up (&c->completion_wait);      /* Wake up waiter. */
+            c->completions++;                   /* Wake up waiter later. */
+            softirq_raise (SOFTIRQ_BLOCK);
           }
         else
-          printf ("%s: unexpected interrupt\n", c->name);
+          {
+            /* Printing takes far too long with interrupts off. */
+            c->unexpected++;
+            work_queue (&c->report_work);
+          }
         return;
       }
 
   NOT_REACHED ();
 }
 
+/* Block softirq: wakes up the threads waiting for the interrupts
+   that interrupt_handler() acknowledged. */
+static void
+ide_softirq (void)
+{
+  struct channel *c;
+
+  for (c = channels; c < channels + CHANNEL_CNT; c++)
+    for (;;)
+      {
+        enum intr_level old_level = intr_disable ();
+        bool completed = c->completions > 0;
+        if (completed)
+          {
+            c->completions--;
+            sema_up (&c->completion_wait);
+          }
+        intr_set_level (old_level);
+        if (!completed)
+          break;
+      }
+}
+
+/* Reports the unexpected interrupts on channel C_, from the
+   kernel worker thread. */
+static void
+report_unexpected (void *c_)
+{
+  struct channel *c = c_;
+  enum intr_level old_level;
+  unsigned cnt;
+
+  old_level = intr_disable ();
+  cnt = c->unexpected;
+  c->unexpected = 0;
+  intr_set_level (old_level);
+
+  while (cnt-- > 0)
+    printf ("%s: unexpected interrupt\n", c->name);
+}
+
 
@@ -3,6 +3,7 @@
 #include <stdint.h>
 #include "threads/interrupt.h"
 #include "threads/io.h"
+#include "threads/tsc.h"
 
 /* Interface to 8254 Programmable Interrupt Timer (PIT).
    Refer to [8254] for details. */
@@ -14,6 +15,14 @@
 /* PIT cycles per second. */
 #define PIT_HZ 1193180
 
+/* Keyboard controller port B, which gates channel 2 (bit 0),
+   enables the speaker (bit 1), and reads back channel 2's
+   output (bit 5). */
+#define PIT_PORT_GATE 0x61
+#define PIT_GATE_ENABLE  0x01
+#define PIT_GATE_SPEAKER 0x02
+#define PIT_GATE_OUT2    0x20
+
 /* Configure the given CHANNEL in the PIT.  In a PC, the PIT's
    three output channels are hooked up like this:
 
@@ -81,3 +90,43 @@ pit_configure_channel (int channel, int mode, int frequency)
   outb (PIT_PORT_COUNTER (channel), count >> 8);
   intr_set_level (old_level);
 }
+
+/* Runs channel 2 as a one-shot for about US microseconds, with
+   the speaker disconnected, and returns the number of TSC cycles
+   that elapsed until its output went high.  US must be small
+   enough that the count fits in 16 bits, that is, below about
+   54 ms.  Used to calibrate the TSC without waiting for timer
+   interrupts.  Clobbers any tone being played on the speaker. */
+uint64_t
+pit_measure_tsc (int us)
+{
+  uint32_t count = (uint64_t) PIT_HZ * us / 1000000;
+  uint64_t start, end;
+  enum intr_level old_level;
+  uint8_t gate;
+
+  ASSERT (count > 0 && count <= 0xffff);
+
+  old_level = intr_disable ();
+
+  /* Open the gate with the speaker off, then load channel 2 in
+     mode 0 (interrupt on terminal count): its output stays low
+     until the count runs out. */
+  gate = inb (PIT_PORT_GATE);
+  outb (PIT_PORT_GATE, (gate & ~PIT_GATE_SPEAKER) | PIT_GATE_ENABLE);
+  outb (PIT_PORT_CONTROL, (2 << 6) | 0x30 | (0 << 1));
+  outb (PIT_PORT_COUNTER (2), count);
+  outb (PIT_PORT_COUNTER (2), count >> 8);
+
+  start = rdtsc ();
+  while ((inb (PIT_PORT_GATE) & PIT_GATE_OUT2) == 0)
+    continue;
+  end = rdtsc ();
+
+  outb (PIT_PORT_GATE, gate & ~(PIT_GATE_SPEAKER | PIT_GATE_ENABLE));
+  intr_set_level (old_level);
+
+  /* Scale by the count actually programmed, not the one asked
+     for, to avoid the rounding error. */
+  return (end - start) * us * PIT_HZ / ((uint64_t) count * 1000000);
+}
@@ -4,5 +4,6 @@
 #include <stdint.h>
 
 void pit_configure_channel (int channel, int mode, int frequency);
+uint64_t pit_measure_tsc (int us);
 
 #endif /* devices/pit.h */
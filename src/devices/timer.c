@@ -7,6 +7,7 @@
 #include "threads/interrupt.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/tsc.h"
   
 /* See [8254] for hardware details of the 8254 timer chip. */
 
@@ -20,12 +21,38 @@
 /* Number of timer ticks since OS booted. */
 static int64_t ticks;
 
+/* Number of real 8254 interrupts since OS booted.  Differs from
+   `ticks' by the timer tick emulation factor. */
+static int64_t real_ticks;
+
 /* Number of loops per timer tick.
    Initialized by timer_calibrate(). */
 static unsigned loops_per_tick;
 
+/* TSC frequency in Hz and TSC value at calibration time.
+   Initialized by timer_calibrate(); 0 until then. */
+static uint64_t tsc_hz;
+static uint64_t tsc_base;
+static int64_t tsc_base_ns;
+
+/* Calibration supplied by timer_set_calibration(), if any. */
+static uint64_t preset_tsc_khz;
+static unsigned preset_loops_per_tick;
+
+#define NS_PER_SEC 1000000000LL
+#define NS_PER_REAL_TICK (NS_PER_SEC / REAL_TIMER_FREQ)
+
+/* Threads sleeping for less than a timer tick, ordered by the
+   time they should be woken up.  Checked on every real 8254
+   interrupt, so they wake up at most one real interrupt late. */
+static struct list hr_sleep_list;
+
 static intr_handler_func timer_interrupt;
-static bool too_many_loops (unsigned loops);
+static softirq_func timer_softirq;
+static void hr_sleep (int64_t deadline);
+static bool awake_ns_less (const struct list_elem *, const struct list_elem *,
+                           void *aux);
+static uint64_t busy_wait_cycles (int64_t loops);
 static void busy_wait (int64_t loops);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
@@ -33,7 +60,6 @@ static void real_time_delay (int64_t num, int32_t denom);
 /* List of sleeping processes, that is, processes that should be 
 	 checked each tick whether it should be awake or not. */
 extern struct list sleep_list;            /* extern from threads/threads.c */
-extern struct list pri_list[PRI_MAX+1];   /* extern from threads/threads.c */
 extern struct list rcc_list;              /* extern from threads/threads.c */
 extern int thread_priority;               /* extern from threads/threads.c */   
 
@@ -42,35 +68,115 @@ extern int thread_priority;               /* extern from threads/threads.c */
 void
 timer_init (void) 
 {
+	list_init (&hr_sleep_list);
 	pit_configure_channel (0, 2, REAL_TIMER_FREQ); /* Use REAL_TIMER_FREQ for timer emulation. */
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
+  softirq_register (SOFTIRQ_TIMER, timer_softirq, "timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Length of the PIT gate window used to measure the TSC, in
+   microseconds. */
+#define CALIBRATE_GATE_US 5000
+
+/* Calibrates loops_per_tick, used to implement brief delays, and
+   the TSC frequency.  Instead of counting timer interrupts, this
+   times a few milliseconds of PIT channel 2 with the TSC and then
+   times busy_wait() with the TSC, so it finishes in well under a
+   timer tick.  Uses the values given to timer_set_calibration()
+   instead, if any. */
 void
 timer_calibrate (void) 
 {
-  unsigned high_bit, test_bit;
+  enum intr_level old_level;
+  uint64_t hz;
 
-  ASSERT (intr_get_level () == INTR_ON);
-  printf ("Calibrating timer...  ");
-
-  /* Approximate loops_per_tick as the largest power-of-two
-     still less than one timer tick. */
-  loops_per_tick = 1u << 10;
-  while (!too_many_loops (loops_per_tick << 1)) 
+  if (preset_tsc_khz != 0)
+    {
+      hz = preset_tsc_khz * 1000;
+      loops_per_tick = preset_loops_per_tick;
+    }
+  else
     {
-      loops_per_tick <<= 1;
+      uint64_t loops_per_sec;
+      int64_t loops;
+
+      printf ("Calibrating timer...  ");
+      hz = pit_measure_tsc (CALIBRATE_GATE_US) * (1000000 / CALIBRATE_GATE_US);
+      ASSERT (hz != 0);
+
+      /* Time busy_wait() against the TSC, doubling the loop count
+         until the run is long enough (about 1 ms) to measure. */
+      for (loops = 1 << 10; ; loops <<= 1)
+        {
+          uint64_t cycles = busy_wait_cycles (loops);
+          if (cycles >= hz / 1000)
+            {
+              loops_per_sec = loops * hz / cycles;
+              break;
+            }
+        }
+      loops_per_tick = loops_per_sec / TIMER_FREQ;
       ASSERT (loops_per_tick != 0);
+
+      printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+      printf ("TSC: %'"PRIu64" Hz (-calib=%"PRIu64",%u).\n",
+              hz, hz / 1000, loops_per_tick);
     }
 
-  /* Refine the next 8 bits of loops_per_tick. */
-  high_bit = loops_per_tick;
-  for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
-    if (!too_many_loops (high_bit | test_bit))
-      loops_per_tick |= test_bit;
+  /* Switch timer_ns() over to the TSC.  The timer interrupt
+     handler calls it, so do so atomically. */
+  old_level = intr_disable ();
+  tsc_base_ns = timer_ns ();
+  tsc_base = rdtsc ();
+  tsc_hz = hz;
+  intr_set_level (old_level);
+}
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+/* Supplies a precomputed TSC frequency, in kHz, and
+   loops_per_tick, so that timer_calibrate() need not measure
+   them.  Use the values printed by an earlier calibration on
+   the same machine. */
+void
+timer_set_calibration (uint64_t tsc_khz, unsigned loops_per_tick_)
+{
+  ASSERT (tsc_khz != 0 && loops_per_tick_ != 0);
+  preset_tsc_khz = tsc_khz;
+  preset_loops_per_tick = loops_per_tick_;
+}
+
+/* Returns the number of TSC cycles that LOOPS iterations of
+   busy_wait() take, with interrupts off so that the timing is
+   not disturbed. */
+static uint64_t
+busy_wait_cycles (int64_t loops)
+{
+  enum intr_level old_level;
+  uint64_t start, end;
+
+  old_level = intr_disable ();
+  start = rdtsc ();
+  busy_wait (loops);
+  end = rdtsc ();
+  intr_set_level (old_level);
+  return end - start;
+}
+
+/* Returns the number of nanoseconds since the OS booted,
+   according to the TSC.  Before the TSC is calibrated, falls
+   back to counting real timer interrupts. */
+int64_t
+timer_ns (void)
+{
+  uint64_t delta;
+
+  if (tsc_hz == 0)
+    return real_ticks * NS_PER_REAL_TICK;
+
+  /* Split the conversion so that DELTA * NS_PER_SEC can't
+     overflow. */
+  delta = rdtsc () - tsc_base;
+  return tsc_base_ns + (int64_t) (delta / tsc_hz * NS_PER_SEC
+                                  + delta % tsc_hz * NS_PER_SEC / tsc_hz);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
@@ -109,6 +215,38 @@ timer_sleep (int64_t ticks)
 	intr_enable ();
 }
 
+/* Blocks the current thread, as thread_block() does, until it
+   is unblocked or until timer tick DEADLINE, whichever comes
+   first.  The caller must already have put the thread on some
+   wait list through its `elem' member, as sema_down() does; a
+   timeout takes it off that list again.  Returns true if the
+   thread was unblocked, false if it timed out.
+
+   The thread sits on sleep_list as well as on the wait list, but
+   it is blocked only once, and whoever gets to it first wakes it.
+   Interrupts must be turned off. */
+bool
+timer_block (int64_t deadline)
+{
+	struct thread *t = thread_current ();
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+	t->awake_tick = deadline;
+	t->timed_wait = true;
+	t->timed_out = false;
+	list_push_back (&sleep_list, &t->sleepelem);
+	thread_block ();
+
+	/* If we were woken by the timer, timer_softirq() already took
+	   us off sleep_list.  Otherwise it cannot be running now, since
+	   we are, so it is safe to do it ourselves. */
+	if (!t->timed_out)
+		list_remove (&t->sleepelem);
+	t->timed_wait = false;
+	return !t->timed_out;
+}
+
 /* Sleeps for approximately MS milliseconds.  Interrupts must be
    turned on. */
 void
@@ -183,9 +321,22 @@ timer_print_stats (void)
 static void
 timer_interrupt (struct intr_frame *args UNUSED)
 {
-	/* Timer tick emulation. */
-	static int64_t real_ticks = 0;
 	real_ticks++;
+
+	/* Wake high-resolution sleepers whose time has come. */
+	if (!list_empty (&hr_sleep_list)) {
+		int64_t now_ns = timer_ns ();
+		while (!list_empty (&hr_sleep_list)) {
+			struct thread *t = list_entry (list_front (&hr_sleep_list),
+			                               struct thread, sleepelem);
+			if (t->awake_ns > now_ns)
+				break;
+			list_pop_front (&hr_sleep_list);
+			thread_unblock (t);
+		}
+	}
+
+	/* Timer tick emulation. */
 	register int ticks_per_upper_tick = thread_mlfqs
 			? TIMER_FREQ_FAKENESS 
 			: TIMER_FREQ_FAKENESS * TIMER_FREQ_REDUCE_FACTOR;
@@ -196,89 +347,106 @@ timer_interrupt (struct intr_frame *args UNUSED)
   ASSERT (intr_get_level () == INTR_OFF);
 
   ticks++;  /* Emulated timer tick. */
-	barrier();
-  int64_t now = ticks;
-	struct list_elem *e;
-	bool yield=false;
-
   thread_tick ();
 
-	/* Per second job. */
-	if (thread_mlfqs && (now % TIMER_FREQ == 0) ) {
-		update_load_avg();
-		update_recent_cpu();
-	}
-	
-	/* Per 4 ticks job. */
-	if (thread_mlfqs && (now % 4 == 0)) {
-		/* For recent_cpu changed threads, update it's priority. */
-		for ( e = list_begin (&rcc_list); e != list_end (&rcc_list) ;) {
-			int i, new_priority;
-			register int a;
-			struct thread *t = list_entry (e, struct thread, rccelem);
-
-			/* Recalculated it's priority. */
-			a = ftopc ( t->recent_cpu ) / 40;
-			a = a%10 > 5 ? a/10 + 1 : a/10;  /* .5 should be rounded down.
-																					Because we'll use (-a). */
-			new_priority = PRI_MAX - a - t->nice * 2;
-
-			/* Adjust it's range. */
-			if (new_priority < PRI_MIN)
-				new_priority = PRI_MIN;
-			else if (new_priority > PRI_MAX)
-				new_priority = PRI_MAX;
-
-			/* Set priority to new value. */
-			t->priority = new_priority;
-			t->original_priority = new_priority;
-
-			/* If it's in ready_list, reset the location to new priority. */
-			if (t->status==THREAD_READY){
-				list_remove (&t->prielem);
-				list_push_back (&pri_list[t->priority], &t->prielem);
-			}
+	/* Leave the rest, which takes time proportional to the number
+	   of threads, to timer_softirq(). */
+	softirq_raise (SOFTIRQ_TIMER);
+}
 
-			/* Remove from recent_cpu changed list. And unmark the thread. */
-			e = list_remove (e);   /* Now `e' is set to the next element. */
-			t->rcc = false;
+/* Timer softirq: per-tick bookkeeping that used to run in
+   timer_interrupt() with interrupts off.  Runs with interrupts
+   on, turning them off only around each update that a timer
+   interrupt could race with, so that the time interrupts stay
+   off does not grow with the number of threads.  Catches up on
+   every emulated tick since it last ran. */
+static void
+timer_softirq (void)
+{
+	static int64_t done_ticks;  /* Last tick processed. */
+	enum intr_level old_level;
+	struct list_elem *e;
+	int64_t now;
 
-			if (!yield)  for ( i=PRI_MAX ; i>thread_priority ; i-- )
-				if (!list_empty (&pri_list[i])){
-					yield=true;
-					intr_yield_on_return ();
-					break;
-				}
+	for (;;) {
+		old_level = intr_disable ();
+		if (done_ticks == ticks) {
+			intr_set_level (old_level);
+			break;
 		}
-	}
+		now = ++done_ticks;
+		intr_set_level (old_level);
 
-	/* Wake sleeping threads. */
-	for ( e = list_begin (&sleep_list); e != list_end (&sleep_list); e = list_next (e)){
-		struct thread *t = list_entry(e, struct thread, sleepelem);
-		if ( t->awake_tick <= now ){
-			e = list_remove (e)->prev;
-			thread_unblock (t);
+		/* Per second job. */
+		if (thread_mlfqs && (now % TIMER_FREQ == 0) ) {
+			update_load_avg();
+			update_recent_cpu();
 		}
-	}
-}
 
-/* Returns true if LOOPS iterations waits for more than one timer
-   tick, otherwise false. */
-static bool
-too_many_loops (unsigned loops) 
-{
-  /* Wait for a timer tick. */
-  int64_t start = ticks;
-  while (ticks == start)
-    barrier ();
+		/* Per 4 ticks job. */
+		if (thread_mlfqs && (now % 4 == 0)) {
+			/* For recent_cpu changed threads, update it's priority.
+			   thread_tick() adds to rcc_list from the timer interrupt, so
+			   take threads off it with interrupts off. */
+			for (;;) {
+				int new_priority;
+				struct thread *t;
+				bool higher;
+
+				old_level = intr_disable ();
+				if (list_empty (&rcc_list)) {
+					intr_set_level (old_level);
+					break;
+				}
+				t = list_entry (list_pop_front (&rcc_list), struct thread, rccelem);
+				t->rcc = false;
 
-  /* Run LOOPS loops. */
-  start = ticks;
-  busy_wait (loops);
+				/* Recalculated it's priority. */
+				new_priority = thread_mlfqs_priority (t);
+
+				/* Set priority to new value. */
+				t->priority = new_priority;
+				t->original_priority = new_priority;
+
+				/* If it's in the run queue, reset the location to new priority. */
+				thread_requeue (t);
+				higher = thread_ready_higher (thread_priority);
+				intr_set_level (old_level);
+
+				if (higher)
+					intr_yield_on_return ();
+			}
+		}
 
-  /* If the tick count changed, we iterated too long. */
-  barrier ();
-  return start != ticks;
+		/* Wake sleeping threads.  Only threads, with interrupts off,
+		   add to or remove from sleep_list, and they cannot run until
+		   softirqs are done, so the scan itself can run with interrupts
+		   on.  A thread in timer_block() may be woken by an interrupt
+		   handler at any time, though, so interrupts are turned off to
+		   look at one. */
+		for ( e = list_begin (&sleep_list); e != list_end (&sleep_list); ){
+			struct thread *t = list_entry(e, struct thread, sleepelem);
+			if ( t->awake_tick > now ){
+				e = list_next (e);
+				continue;
+			}
+			old_level = intr_disable ();
+			if (!t->timed_wait) {
+				e = list_remove (e);
+				thread_unblock (t);
+			} else if (t->status == THREAD_BLOCKED) {
+				/* Timed out: take it off the list it waits on, too. */
+				e = list_remove (e);
+				list_remove (&t->elem);
+				t->timed_out = true;
+				thread_unblock (t);
+			} else {
+				/* Already woken, it will leave sleep_list by itself. */
+				e = list_next (e);
+			}
+			intr_set_level (old_level);
+		}
+	}
 }
 
 /* Iterates through a simple loop LOOPS times, for implementing
@@ -308,6 +476,7 @@ real_time_sleep (int64_t num, int32_t denom)
   int64_t ticks = num * TIMER_FREQ / denom;
 
   ASSERT (intr_get_level () == INTR_ON);
+  ASSERT (NS_PER_SEC % denom == 0);
   if (ticks > 0)
     {
       /* We're waiting for at least one full timer tick.  Use
@@ -315,6 +484,12 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (tsc_hz != 0)
+    {
+      /* Otherwise, if the TSC is calibrated, wait for a
+         high-resolution deadline. */
+      hr_sleep (timer_ns () + num * (NS_PER_SEC / denom));
+    }
   else 
     {
       /* Otherwise, use a busy-wait loop for more accurate
@@ -323,10 +498,63 @@ real_time_sleep (int64_t num, int32_t denom)
     }
 }
 
+/* Sleeps until timer_ns() reaches DEADLINE.
+
+   If that is at least one real timer interrupt away, blocks on
+   hr_sleep_list until timer_interrupt() wakes us.  Shorter waits,
+   such as the 400 ns a disk needs after a device select, would
+   oversleep by up to a whole real timer period if they waited
+   for an interrupt, so we spin on the TSC instead. */
+static void
+hr_sleep (int64_t deadline)
+{
+  struct thread *t;
+  enum intr_level old_level;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  old_level = intr_disable ();
+  if (deadline - timer_ns () >= NS_PER_REAL_TICK)
+    {
+      t = thread_current ();
+      t->awake_ns = deadline;
+      list_insert_ordered (&hr_sleep_list, &t->sleepelem,
+                           awake_ns_less, NULL);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+
+  while (timer_ns () < deadline)
+    barrier ();
+}
+
+/* Returns true if the thread of A should wake up before that of
+   B on hr_sleep_list. */
+static bool
+awake_ns_less (const struct list_elem *a, const struct list_elem *b,
+               void *aux UNUSED)
+{
+  return list_entry (a, struct thread, sleepelem)->awake_ns
+         < list_entry (b, struct thread, sleepelem)->awake_ns;
+}
+
 /* Busy-wait for approximately NUM/DENOM seconds. */
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
+  int64_t deadline;
+
+  /* Once the TSC is calibrated, spin on it: that does not depend
+     on code alignment or on interrupts staying on. */
+  if (tsc_hz != 0)
+    {
+      ASSERT (NS_PER_SEC % denom == 0);
+      deadline = timer_ns () + num * (NS_PER_SEC / denom);
+      while (timer_ns () < deadline)
+        barrier ();
+      return;
+    }
+
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
@@ -2,6 +2,7 @@
 #define DEVICES_TIMER_H
 
 #include <round.h>
+#include <stdbool.h>
 #include <stdint.h>
 
 /* Number of timer interrupts per second. */
@@ -19,15 +20,18 @@
 
 void timer_init (void);
 void timer_calibrate (void);
+void timer_set_calibration (uint64_t tsc_khz, unsigned loops_per_tick);
 
 int64_t timer_ticks (void);
 int64_t timer_elapsed (int64_t);
+int64_t timer_ns (void);
 
 /* Sleep and yield the CPU to other threads. */
 void timer_sleep (int64_t ticks);
 void timer_msleep (int64_t milliseconds);
 void timer_usleep (int64_t microseconds);
 void timer_nsleep (int64_t nanoseconds);
+bool timer_block (int64_t deadline);
 
 /* Busy waits. */
 void timer_mdelay (int64_t milliseconds);
@@ -0,0 +1,340 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "filesys/free-map.h"
+#include "devices/timer.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+
+/* Buffer cache.
+
+   Keeps the CACHE_SIZE most recently used sectors of the file
+   system device in memory.  Every access to fs_device goes
+   through here, so that file data, inodes and directories are
+   read from disk once and written back lazily ("write-behind"):
+   when a dirty sector is evicted, every CACHE_FLUSH_INTERVAL
+   ticks from the flush thread, and from filesys_done().
+
+   Victims are chosen by the clock algorithm.
+
+   cache_prefetch() queues sectors to be read in the background,
+   by the kernel workqueue, for read-ahead.
+
+   cache_lock protects only which sector each entry holds, and is
+   never held across disk I/O.  Each entry has its own lock,
+   which guards its data and is held across its I/O, so that
+   misses on different sectors go to disk concurrently and a hit
+   waits only for a miss on the same sector.  An entry that some
+   thread is using or waiting for is pinned, and is never chosen
+   for eviction. */
+#define CACHE_SIZE 64
+#define CACHE_FLUSH_INTERVAL (5 * TIMER_FREQ)
+#define CACHE_FLUSH_BUDGET (CACHE_FLUSH_INTERVAL / 20)
+
+/* A cached sector. */
+struct cache_entry
+  {
+    /* Protected by cache_lock. */
+    block_sector_t sector;              /* Sector held, if valid. */
+    bool valid;                         /* Holds a sector? */
+    bool accessed;                      /* Used since the clock hand passed? */
+    int pin_cnt;                        /* # of threads using or awaiting it. */
+    bool writing_back;                  /* Writing back an evicted sector? */
+    block_sector_t old_sector;          /* The sector, if writing_back. */
+
+    /* Protected by LOCK. */
+    struct lock lock;                   /* Held while using DATA. */
+    bool dirty;                         /* Modified since read? */
+    uint8_t data[BLOCK_SECTOR_SIZE];    /* Sector contents. */
+  };
+
+static struct cache_entry cache[CACHE_SIZE];
+static struct lock cache_lock;
+static size_t clock_hand;               /* Next entry to consider evicting. */
+
+/* Sectors queued for read-ahead, a ring of up to PREFETCH_MAX.
+   Protected by prefetch_lock, which unlike cache_lock is never
+   held across disk I/O, so that queuing never waits for a disk. */
+#define PREFETCH_MAX 64
+static block_sector_t prefetch_queue[PREFETCH_MAX];
+static size_t prefetch_head, prefetch_cnt;
+static struct lock prefetch_lock;
+static struct work prefetch_work;
+
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_get (block_sector_t, bool read);
+static void cache_put (struct cache_entry *);
+static void prefetch_worker (void *aux);
+static void flush_thread (void *aux);
+
+/* Initializes the buffer cache and starts its flush thread. */
+void
+cache_init (void)
+{
+  struct cache_entry *e;
+
+  lock_init (&cache_lock);
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    lock_init (&e->lock);
+  lock_init (&prefetch_lock);
+  work_init (&prefetch_work, prefetch_worker, NULL);
+  thread_create_periodic ("cache-flush", CACHE_FLUSH_INTERVAL,
+                          CACHE_FLUSH_BUDGET, flush_thread, NULL);
+}
+
+/* Reads sector SECTOR of the file system device into BUFFER,
+   which must have room for BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at byte OFS of sector SECTOR of the
+   file system device into BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, true);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes BLOCK_SECTOR_SIZE bytes from BUFFER to sector SECTOR of
+   the file system device.  The data reaches the disk later. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER starting at byte OFS of sector
+   SECTOR of the file system device.  The data reaches the disk
+   later. */
+void
+cache_write_at (block_sector_t sector, const void *buffer, int ofs, int size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs >= 0 && size >= 0 && ofs + size <= BLOCK_SECTOR_SIZE);
+
+  /* Overwriting a whole sector, we need not read it first. */
+  e = cache_get (sector, size < BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Asks for SECTOR of the file system device to be read into the
+   cache soon, without waiting for it.  Quietly does nothing if
+   SECTOR is queued already or too many sectors are. */
+void
+cache_prefetch (block_sector_t sector)
+{
+  size_t i;
+
+  lock_acquire (&prefetch_lock);
+  for (i = 0; i < prefetch_cnt; i++)
+    if (prefetch_queue[(prefetch_head + i) % PREFETCH_MAX] == sector)
+      {
+        lock_release (&prefetch_lock);
+        return;
+      }
+  if (prefetch_cnt < PREFETCH_MAX)
+    {
+      prefetch_queue[(prefetch_head + prefetch_cnt++) % PREFETCH_MAX] = sector;
+      work_queue (&prefetch_work);
+    }
+  lock_release (&prefetch_lock);
+}
+
+/* Writes every dirty sector in the cache to disk. */
+void
+cache_flush (void)
+{
+  struct cache_entry *e;
+
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    {
+      lock_acquire (&cache_lock);
+      if (!e->valid)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->pin_cnt++;
+      lock_release (&cache_lock);
+
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        {
+          block_write (fs_device, e->sector, e->data);
+          e->dirty = false;
+        }
+      cache_put (e);
+    }
+}
+
+/* Returns the cache entry for SECTOR, with its lock held,
+   bringing it into the cache if necessary, and marks it
+   accessed.  If READ is false, the caller is about to overwrite
+   the whole sector, so a newly cached sector is not read from
+   disk.  The caller must release the entry with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool read)
+{
+  struct cache_entry *e;
+  block_sector_t old_sector;
+  bool write_back;
+  size_t i;
+
+  for (;;)
+    {
+      lock_acquire (&cache_lock);
+
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          /* Hit.  Wait for any I/O on the entry to finish.
+             Being pinned, it still holds SECTOR afterward. */
+          e->accessed = true;
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      /* If SECTOR was just evicted and is still being written
+         back, reading it now would get stale data.  Wait for the
+         write to finish, then start over. */
+      for (i = 0; i < CACHE_SIZE; i++)
+        if (cache[i].writing_back && cache[i].old_sector == sector)
+          break;
+      if (i < CACHE_SIZE)
+        {
+          e = &cache[i];
+          e->pin_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          cache_put (e);
+          continue;
+        }
+
+      /* Miss.  Sweep the clock hand until it finds an unpinned
+         entry that has not been accessed since the last sweep.
+         Two full sweeps without one mean every entry is pinned,
+         so let the other threads get on and try again. */
+      for (i = 0; i < 2 * CACHE_SIZE; i++)
+        {
+          e = &cache[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SIZE;
+          if (e->pin_cnt == 0 && (!e->valid || !e->accessed))
+            break;
+          e->accessed = false;
+        }
+      if (i < 2 * CACHE_SIZE)
+        break;
+      lock_release (&cache_lock);
+      thread_yield ();
+    }
+
+  /* An unpinned entry's lock is free, so this does not block. */
+  lock_acquire (&e->lock);
+  write_back = e->valid && e->dirty;
+  old_sector = e->sector;
+  e->writing_back = write_back;
+  e->old_sector = old_sector;
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = true;
+  e->pin_cnt = 1;
+  e->dirty = false;
+  lock_release (&cache_lock);
+
+  if (write_back)
+    {
+      block_write (fs_device, old_sector, e->data);
+      lock_acquire (&cache_lock);
+      e->writing_back = false;
+      lock_release (&cache_lock);
+    }
+  if (read)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Releases cache entry E obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+  lock_acquire (&cache_lock);
+  e->pin_cnt--;
+  lock_release (&cache_lock);
+}
+
+/* Returns the cache entry holding SECTOR, or a null pointer if
+   it is not cached.  cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  struct cache_entry *e;
+
+  for (e = cache; e < cache + CACHE_SIZE; e++)
+    if (e->valid && e->sector == sector)
+      return e;
+  return NULL;
+}
+
+/* Reads the sectors queued by cache_prefetch() into the cache.
+   Runs in the workqueue thread. */
+static void
+prefetch_worker (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      block_sector_t sector;
+
+      lock_acquire (&prefetch_lock);
+      if (prefetch_cnt == 0)
+        {
+          lock_release (&prefetch_lock);
+          break;
+        }
+      sector = prefetch_queue[prefetch_head];
+      prefetch_head = (prefetch_head + 1) % PREFETCH_MAX;
+      prefetch_cnt--;
+      lock_release (&prefetch_lock);
+
+      lock_acquire (&cache_lock);
+      e = cache_lookup (sector);
+      lock_release (&cache_lock);
+      if (e == NULL)
+        cache_put (cache_get (sector, true));
+    }
+}
+
+/* Writes dirty sectors back every CACHE_FLUSH_INTERVAL ticks, so
+   that a crash loses little.  The free map's changes are held
+   back until then too, so they are put in the cache first.
+
+   Runs as a periodic thread with a budget of CACHE_FLUSH_BUDGET
+   ticks, so that a flush starts on time however busy the CPU
+   is, without a large one starving everyone else. */
+static void
+flush_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      thread_wait_period ();
+      free_map_flush ();
+      cache_flush ();
+    }
+}
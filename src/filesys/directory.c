@@ -1,10 +1,12 @@
 #include "filesys/directory.h"
 #include <stdio.h>
 #include <string.h>
+#include <hash.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -21,6 +23,43 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
+/* In-memory index of a directory's entries.  It is built by one
+   scan of the directory the first time the directory is searched
+   and then hangs off the shared in-memory inode, so every opener
+   sees the same index and it stays in step with the entries on
+   disk as long as they are changed only through this module.
+   Lookup, add and remove then touch at most one entry on disk. */
+struct dir_index
+  {
+    struct lock lock;                   /* Protects members below. */
+    struct hash names;                  /* Slots in use, keyed by name. */
+    struct list free_slots;             /* Slots not in use. */
+  };
+
+/* The in-memory copy of one directory entry slot. */
+struct dir_slot
+  {
+    struct hash_elem hash_elem;         /* Element in `names'. */
+    struct list_elem list_elem;         /* Element in `free_slots'. */
+    off_t ofs;                          /* Byte offset of entry. */
+    block_sector_t inode_sector;        /* Sector number of header. */
+    char name[NAME_MAX + 1];            /* Null terminated file name. */
+  };
+
+/* Number of entries read at a time when building an index. */
+#define INDEX_SCAN_CNT 32
+
+/* Serializes building indexes, so that two openers of the same
+   directory do not both build one. */
+static struct lock index_lock;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  lock_init (&index_lock);
+}
+
 /* Creates a directory with space for ENTRY_CNT entries in the
    given SECTOR.  Returns true if successful, false on failure. */
 bool
@@ -83,32 +122,150 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
-/* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
-   if EP is non-null, and sets *OFSP to the byte offset of the
-   directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
+/* Returns a hash value for dir_slot E. */
+static unsigned
+slot_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct dir_slot *s = hash_entry (e, struct dir_slot, hash_elem);
+  return hash_string (s->name);
+}
+
+/* Returns true if dir_slot A's name precedes dir_slot B's. */
 static bool
-lookup (const struct dir *dir, const char *name,
-        struct dir_entry *ep, off_t *ofsp) 
+slot_less (const struct hash_elem *a, const struct hash_elem *b,
+           void *aux UNUSED)
 {
-  struct dir_entry e;
-  size_t ofs;
-  
-  ASSERT (dir != NULL);
+  const struct dir_slot *sa = hash_entry (a, struct dir_slot, hash_elem);
+  const struct dir_slot *sb = hash_entry (b, struct dir_slot, hash_elem);
+  return strcmp (sa->name, sb->name) < 0;
+}
+
+/* Frees the dir_slot that contains hash element E. */
+static void
+slot_free (struct hash_elem *e, void *aux UNUSED)
+{
+  free (hash_entry (e, struct dir_slot, hash_elem));
+}
+
+/* Destroys INDEX and frees all of its slots.
+   INDEX may be a null pointer. */
+void
+dir_index_destroy (struct dir_index *index)
+{
+  if (index == NULL)
+    return;
+
+  hash_destroy (&index->names, slot_free);
+  while (!list_empty (&index->free_slots))
+    {
+      struct list_elem *e = list_pop_front (&index->free_slots);
+      free (list_entry (e, struct dir_slot, list_elem));
+    }
+  free (index);
+}
+
+/* Adds entry E, found at byte offset OFS, to INDEX.
+   Returns true if successful, false if out of memory. */
+static bool
+index_add_entry (struct dir_index *index, const struct dir_entry *e,
+                 off_t ofs)
+{
+  struct dir_slot *s = malloc (sizeof *s);
+  if (s == NULL)
+    return false;
+
+  s->ofs = ofs;
+  if (e->in_use)
+    {
+      s->inode_sector = e->inode_sector;
+      strlcpy (s->name, e->name, sizeof s->name);
+      hash_insert (&index->names, &s->hash_elem);
+    }
+  else
+    list_push_back (&index->free_slots, &s->list_elem);
+  return true;
+}
+
+/* Builds and returns an index of the entries in directory INODE.
+   Returns a null pointer if memory allocation fails. */
+static struct dir_index *
+index_build (struct inode *inode)
+{
+  struct dir_index *index;
+  struct dir_entry *buf;
+  off_t ofs, size;
+  size_t i, cnt;
+
+  index = malloc (sizeof *index);
+  if (index == NULL)
+    return NULL;
+  if (!hash_init (&index->names, slot_hash, slot_less, NULL))
+    {
+      free (index);
+      return NULL;
+    }
+  lock_init (&index->lock);
+  list_init (&index->free_slots);
+
+  buf = malloc (INDEX_SCAN_CNT * sizeof *buf);
+  if (buf == NULL)
+    goto fail;
+  for (ofs = 0; ; ofs += cnt * sizeof *buf)
+    {
+      size = inode_read_at (inode, buf, INDEX_SCAN_CNT * sizeof *buf, ofs);
+      cnt = size / sizeof *buf;
+      if (cnt == 0)
+        break;
+      for (i = 0; i < cnt; i++)
+        if (!index_add_entry (index, &buf[i], ofs + i * sizeof *buf))
+          goto fail;
+    }
+  free (buf);
+  return index;
+
+ fail:
+  free (buf);
+  dir_index_destroy (index);
+  return NULL;
+}
+
+/* Returns the index for DIR, building it if this is the first
+   time DIR's inode has been searched.
+   Returns a null pointer if memory allocation fails. */
+static struct dir_index *
+get_index (const struct dir *dir)
+{
+  struct dir_index *index;
+
+  lock_acquire (&index_lock);
+  index = inode_get_dir_index (dir->inode);
+  if (index == NULL)
+    {
+      index = index_build (dir->inode);
+      if (index != NULL)
+        inode_set_dir_index (dir->inode, index);
+    }
+  lock_release (&index_lock);
+  return index;
+}
+
+/* Searches INDEX for a slot in use with the given NAME and
+   returns it, or a null pointer if there is none.
+   INDEX's lock must be held. */
+static struct dir_slot *
+lookup (struct dir_index *index, const char *name) 
+{
+  struct dir_slot key;
+  struct hash_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&index->lock));
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  if (strlen (name) > NAME_MAX)
+    return NULL;
+  strlcpy (key.name, name, sizeof key.name);
+  e = hash_find (&index->names, &key.hash_elem);
+  return e != NULL ? hash_entry (e, struct dir_slot, hash_elem) : NULL;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -119,15 +276,22 @@ bool
 dir_lookup (const struct dir *dir, const char *name,
             struct inode **inode) 
 {
-  struct dir_entry e;
+  struct dir_index *index;
+  struct dir_slot *s;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
-    *inode = inode_open (e.inode_sector);
-  else
-    *inode = NULL;
+  *inode = NULL;
+  index = get_index (dir);
+  if (index == NULL)
+    return false;
+
+  lock_acquire (&index->lock);
+  s = lookup (index, name);
+  if (s != NULL)
+    *inode = inode_open (s->inode_sector);
+  lock_release (&index->lock);
 
   return *inode != NULL;
 }
@@ -141,8 +305,10 @@ dir_lookup (const struct dir *dir, const char *name,
 bool
 dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 {
+  struct dir_index *index;
+  struct dir_slot *s;
   struct dir_entry e;
-  off_t ofs;
+  bool reused;
   bool success = false;
 
   ASSERT (dir != NULL);
@@ -152,29 +318,50 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
+  index = get_index (dir);
+  if (index == NULL)
+    return false;
+  lock_acquire (&index->lock);
+
   /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
+  if (lookup (index, name) != NULL)
     goto done;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
+  /* Take a free slot.
+     If there are no free slots, then append one at the current
+     end-of-file. */
+  reused = !list_empty (&index->free_slots);
+  if (reused)
+    s = list_entry (list_pop_front (&index->free_slots),
+                    struct dir_slot, list_elem);
+  else
+    {
+      s = malloc (sizeof *s);
+      if (s == NULL)
+        goto done;
+      s->ofs = inode_length (dir->inode);
+    }
 
   /* Write slot. */
+  memset (&e, 0, sizeof e);
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  success = inode_write_at (dir->inode, &e, sizeof e, s->ofs) == sizeof e;
+
+  if (success)
+    {
+      strlcpy (s->name, name, sizeof s->name);
+      s->inode_sector = inode_sector;
+      hash_insert (&index->names, &s->hash_elem);
+    }
+  else if (reused)
+    list_push_front (&index->free_slots, &s->list_elem);
+  else
+    free (s);
 
  done:
+  lock_release (&index->lock);
   return success;
 }
 
@@ -184,33 +371,44 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
 bool
 dir_remove (struct dir *dir, const char *name) 
 {
+  struct dir_index *index;
+  struct dir_slot *s;
   struct dir_entry e;
   struct inode *inode = NULL;
   bool success = false;
-  off_t ofs;
 
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
+  index = get_index (dir);
+  if (index == NULL)
+    return false;
+  lock_acquire (&index->lock);
+
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  s = lookup (index, name);
+  if (s == NULL)
     goto done;
 
   /* Open inode. */
-  inode = inode_open (e.inode_sector);
+  inode = inode_open (s->inode_sector);
   if (inode == NULL)
     goto done;
 
   /* Erase directory entry. */
+  memset (&e, 0, sizeof e);
   e.in_use = false;
-  if (inode_write_at (dir->inode, &e, sizeof e, ofs) != sizeof e) 
+  if (inode_write_at (dir->inode, &e, sizeof e, s->ofs) != sizeof e) 
     goto done;
+  hash_delete (&index->names, &s->hash_elem);
+  list_push_front (&index->free_slots, &s->list_elem);
 
   /* Remove inode. */
   inode_remove (inode);
   success = true;
 
  done:
+  lock_release (&index->lock);
   inode_close (inode);
   return success;
 }
@@ -12,6 +12,10 @@
 #define NAME_MAX 14
 
 struct inode;
+struct dir_index;
+
+void dir_init (void);
+void dir_index_destroy (struct dir_index *);
 
 /* Opening and closing directories. */
 bool dir_create (block_sector_t sector, size_t entry_cnt);
@@ -1,8 +1,18 @@
 #include "filesys/file.h"
 #include <debug.h>
+#include <round.h>
 #include "filesys/inode.h"
+#include "devices/block.h"
 #include "threads/malloc.h"
 
+/* Read-ahead window bounds, in sectors.  The window starts at
+   RA_MIN on the second of two back-to-back file_read()s and
+   doubles with each further one, up to RA_MAX. */
+#define RA_MIN 4
+#define RA_MAX 32
+
+static void file_readahead (struct file *, off_t pos);
+
 /* Opens a file for the given INODE, of which it takes ownership,
    and returns the new file.  Returns a null pointer if an
    allocation fails or if INODE is null. */
@@ -60,11 +70,51 @@ file_get_inode (struct file *file)
 off_t
 file_read (struct file *file, void *buffer, off_t size) 
 {
-  off_t bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
+  off_t bytes_read;
+
+  file_readahead (file, file->pos);
+  bytes_read = inode_read_at (file->inode, buffer, size, file->pos);
   file->pos += bytes_read;
+  file->ra_next = file->pos;
   return bytes_read;
 }
 
+/* Called before a file_read() of FILE at POS.  If it continues
+   the previous read, grows FILE's read-ahead window and asks the
+   buffer cache to fetch the part of the window beyond what was
+   already requested, in the background.  Otherwise shuts
+   read-ahead off until the reads look sequential again.
+
+   The window is kept in whole sectors, so that a run of small
+   reads asks for more only when it crosses into a new sector. */
+static void
+file_readahead (struct file *file, off_t pos)
+{
+  off_t end;
+
+  if (pos != file->ra_next || pos == 0)
+    {
+      file->ra_window = 0;
+      file->ra_end = ROUND_UP (pos, BLOCK_SECTOR_SIZE);
+      return;
+    }
+
+  if (file->ra_window == 0)
+    file->ra_window = RA_MIN;
+  else if (file->ra_window < RA_MAX)
+    file->ra_window *= 2;
+
+  if (file->ra_end < pos)
+    file->ra_end = ROUND_UP (pos, BLOCK_SECTOR_SIZE);
+  end = ROUND_UP (pos + (off_t) file->ra_window * BLOCK_SECTOR_SIZE,
+                  BLOCK_SECTOR_SIZE);
+  if (end > file->ra_end)
+    {
+      inode_prefetch (file->inode, file->ra_end, end - file->ra_end);
+      file->ra_end = end;
+    }
+}
+
 /* Reads SIZE bytes from FILE into BUFFER,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually read,
@@ -79,9 +129,8 @@ file_read_at (struct file *file, void *buffer, off_t size, off_t file_ofs)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at the file's current position.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    Advances FILE's position by the number of bytes read. */
 off_t
 file_write (struct file *file, const void *buffer, off_t size) 
@@ -94,9 +143,8 @@ file_write (struct file *file, const void *buffer, off_t size)
 /* Writes SIZE bytes from BUFFER into FILE,
    starting at offset FILE_OFS in the file.
    Returns the number of bytes actually written,
-   which may be less than SIZE if end of file is reached.
-   (Normally we'd grow the file in that case, but file growth is
-   not yet implemented.)
+   which may be less than SIZE if the disk is full.
+   Writing past end of file grows the file.
    The file's current position is unaffected. */
 off_t
 file_write_at (struct file *file, const void *buffer, off_t size,
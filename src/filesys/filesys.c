@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stdio.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/file.h"
 #include "filesys/free-map.h"
 #include "filesys/inode.h"
@@ -10,6 +11,11 @@
 /* Partition that contains the file system. */
 struct block *fs_device;
 
+/* The root directory, held open for as long as the file system is
+   in use so that its in-memory inode, and with it the directory
+   index, is not thrown away whenever no file is open. */
+static struct dir *root_dir;
+
 static void do_format (void);
 
 /* Initializes the file system module.
@@ -21,13 +27,18 @@ filesys_init (bool format)
   if (fs_device == NULL)
     PANIC ("No file system device found, can't initialize file system.");
 
+  cache_init ();
   inode_init ();
+  dir_init ();
   free_map_init ();
 
   if (format) 
     do_format ();
 
   free_map_open ();
+  root_dir = dir_open_root ();
+  if (root_dir == NULL)
+    PANIC ("can't open root directory");
 }
 
 /* Shuts down the file system module, writing any unwritten data
@@ -35,7 +46,9 @@ filesys_init (bool format)
 void
 filesys_done (void) 
 {
+  dir_close (root_dir);
   free_map_close ();
+  cache_flush ();
 }
 
 /* Creates a file named NAME with the given INITIAL_SIZE.
@@ -47,10 +60,16 @@ filesys_create (const char *name, off_t initial_size)
 {
   block_sector_t inode_sector = 0;
   struct dir *dir = dir_open_root ();
-  bool success = (dir != NULL
-                  && free_map_allocate (1, &inode_sector)
-                  && inode_create (inode_sector, initial_size)
-                  && dir_add (dir, name, inode_sector));
+  bool success = false;
+
+  /* Put the inode near its directory, in the same block group. */
+  if (dir != NULL)
+    {
+      block_sector_t goal = inode_get_inumber (dir_get_inode (dir));
+      success = (free_map_allocate_near (goal, 1, &inode_sector)
+                 && inode_create (inode_sector, initial_size)
+                 && dir_add (dir, name, inode_sector));
+    }
   if (!success && inode_sector != 0) 
     free_map_release (inode_sector, 1);
   dir_close (dir);
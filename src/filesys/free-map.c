@@ -1,85 +1,632 @@
 #include "filesys/free-map.h"
 #include <bitmap.h>
 #include <debug.h>
+#include <hash.h>
+#include <round.h>
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
 
+/* Sectors of the free map file changed since they were last
+   written, one bit per sector.  Allocating and releasing only
+   mark them; free_map_flush() writes them out. */
+static struct bitmap *dirty_map;
+#define BITS_PER_SECTOR (BLOCK_SECTOR_SIZE * 8)
+
+/* A maximal run of free sectors.
+
+   The free map is kept on disk as a bitmap, but allocation is
+   served from an index of the free runs built from it, so that
+   it never scans the bitmap bit by bit.  Every run is in two
+   treaps: binary search trees kept balanced by giving each node
+   a priority that looks random, here a hash of the sector the
+   run started at when it was made, and keeping each node's
+   priority above its children's.  runs_by_start orders the runs
+   by starting sector, which lets runs be found near a goal sector
+   and merged with their neighbours when sectors are released.
+   Each of its nodes also records the longest run below it, so
+   that the first long enough run after a goal is found without
+   visiting the short ones in between.  runs_by_size orders the
+   runs by length, then start, which gives a best fit.  Each of
+   these takes time logarithmic in the number of runs. */
+struct free_run;
+struct run_link
+  {
+    struct free_run *left;              /* Lesser runs. */
+    struct free_run *right;             /* Greater runs. */
+  };
+
+struct free_run
+  {
+    struct run_link start_link;         /* Links in runs_by_start. */
+    struct run_link size_link;          /* Links in runs_by_size. */
+    block_sector_t start;               /* First free sector. */
+    size_t length;                      /* Number of free sectors. */
+    unsigned priority;                  /* Treap priority. */
+    size_t max_length;                  /* Longest run in start subtree. */
+  };
+
+/* A treap of free runs. */
+struct run_tree
+  {
+    struct free_run *root;              /* Root, or null if empty. */
+    bool by_size;                       /* Ordered by length first? */
+  };
+
+static struct run_tree runs_by_start = {NULL, false};
+static struct run_tree runs_by_size = {NULL, true};
+
+/* Block groups.  As in FFS, the disk is divided into groups of
+   BLOCK_GROUP_SECTORS sectors, and placement tries to keep a
+   directory, the inodes of its files and their data in one group,
+   so that using them together needs short seeks.  group_free[]
+   counts the free sectors of each group, so that work that should
+   be spread out can be sent to the emptiest one. */
+#define BLOCK_GROUP_SECTORS 1024
+static size_t group_cnt;
+static size_t *group_free;
+
+/* Protects everything above. */
+static struct lock free_map_lock;
+
+static void build_index (void);
+static struct free_run *run_floor (block_sector_t sector);
+static struct free_run *run_first_after (struct free_run *,
+                                         block_sector_t sector, size_t cnt);
+static struct free_run *find_best (size_t cnt);
+static bool take (struct free_run *, block_sector_t sector, size_t cnt);
+static void give_back (block_sector_t sector, size_t cnt);
+static void group_count (block_sector_t sector, size_t cnt, bool freed);
+
 /* Initializes the free map. */
 void
-free_map_init (void) 
+free_map_init (void)
 {
   free_map = bitmap_create (block_size (fs_device));
   if (free_map == NULL)
     PANIC ("bitmap creation failed--file system device is too large");
+  dirty_map = bitmap_create (DIV_ROUND_UP (bitmap_file_size (free_map),
+                                           BLOCK_SECTOR_SIZE));
+  if (dirty_map == NULL)
+    PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+
+  group_cnt = DIV_ROUND_UP (bitmap_size (free_map), BLOCK_GROUP_SECTORS);
+  group_free = malloc (group_cnt * sizeof *group_free);
+  if (group_free == NULL)
+    PANIC ("can't allocate block group table");
+
+  lock_init (&free_map_lock);
+  build_index ();
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
-   the first into *SECTORP.
+   the first into *SECTORP.  Takes them from the shortest run of
+   free sectors that is long enough, to keep long runs for files
+   that need them.
    Returns true if successful, false if not enough consecutive
-   sectors were available or if the free_map file could not be
-   written. */
+   sectors were available or memory allocation failed. */
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
+  struct free_run *r;
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  r = find_best (cnt);
+  if (r != NULL)
     {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
+      *sectorp = r->start;
+      success = take (r, r->start, cnt);
     }
-  if (sector != BITMAP_ERROR)
-    *sectorp = sector;
-  return sector != BITMAP_ERROR;
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates CNT consecutive sectors as close after GOAL as
+   possible and stores the first into *SECTORP: at GOAL itself if
+   it starts a long enough stretch of free sectors, otherwise at
+   the start of the first long enough run after it.  If there is
+   none, falls back to free_map_allocate().
+   Returns true if successful, false if not enough consecutive
+   sectors were available or memory allocation failed. */
+bool
+free_map_allocate_near (block_sector_t goal, size_t cnt,
+                        block_sector_t *sectorp)
+{
+  struct free_run *r;
+  block_sector_t sector = 0;
+  bool success = false;
+
+  lock_acquire (&free_map_lock);
+  r = run_floor (goal);
+  if (r != NULL && r->start + r->length >= goal + cnt)
+    sector = goal;
+  else
+    {
+      r = run_first_after (runs_by_start.root, goal, cnt);
+      if (r == NULL)
+        r = find_best (cnt);
+      if (r != NULL)
+        sector = r->start;
+    }
+  if (r != NULL)
+    {
+      *sectorp = sector;
+      success = take (r, sector, cnt);
+    }
+  lock_release (&free_map_lock);
+  return success;
+}
+
+/* Allocates up to CNT sectors starting exactly at SECTOR, as
+   many as are free there in a row, so that an existing run of
+   sectors that ends just before SECTOR can be extended in place.
+   Returns the number of sectors allocated, which is 0 if SECTOR
+   itself is in use. */
+size_t
+free_map_extend (block_sector_t sector, size_t cnt)
+{
+  struct free_run *r;
+  size_t n = 0;
+
+  lock_acquire (&free_map_lock);
+  r = run_floor (sector);
+  if (r != NULL && r->start == sector)
+    {
+      n = cnt < r->length ? cnt : r->length;
+      take (r, sector, n);
+    }
+  lock_release (&free_map_lock);
+  return n;
+}
+
+/* Returns the block group that SECTOR belongs to. */
+size_t
+free_map_group (block_sector_t sector)
+{
+  return sector / BLOCK_GROUP_SECTORS;
+}
+
+/* Returns the first sector of the block group with the most free
+   sectors, as a goal for allocations that should be spread out
+   over the disk. */
+block_sector_t
+free_map_emptiest_group (void)
+{
+  size_t best = 0;
+  size_t g;
+
+  lock_acquire (&free_map_lock);
+  for (g = 1; g < group_cnt; g++)
+    if (group_free[g] > group_free[best])
+      best = g;
+  lock_release (&free_map_lock);
+  return best * BLOCK_GROUP_SECTORS;
 }
 
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
-  bitmap_write (free_map, free_map_file);
+  bitmap_set_multiple (dirty_map, sector / BITS_PER_SECTOR,
+                       (sector + cnt - 1) / BITS_PER_SECTOR
+                       - sector / BITS_PER_SECTOR + 1, true);
+  give_back (sector, cnt);
+  lock_release (&free_map_lock);
+}
+
+/* Writes the sectors of the free map that have changed since
+   they were last written to the free map file. */
+void
+free_map_flush (void)
+{
+  size_t i;
+
+  lock_acquire (&free_map_lock);
+  if (free_map_file != NULL)
+    for (i = 0; i < bitmap_size (dirty_map); i++)
+      if (bitmap_test (dirty_map, i)
+          && bitmap_write_part (free_map, free_map_file,
+                                i * BLOCK_SECTOR_SIZE, BLOCK_SECTOR_SIZE))
+        bitmap_reset (dirty_map, i);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
 void
-free_map_open (void) 
+free_map_open (void)
 {
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_read (free_map, free_map_file))
     PANIC ("can't read free map");
+  bitmap_set_all (dirty_map, false);
+  build_index ();
 }
 
 /* Writes the free map to disk and closes the free map file. */
 void
-free_map_close (void) 
+free_map_close (void)
 {
+  free_map_flush ();
   file_close (free_map_file);
+  free_map_file = NULL;
 }
 
 /* Creates a new free map file on disk and writes the free map to
    it. */
 void
-free_map_create (void) 
+free_map_create (void)
 {
   /* Create inode. */
   if (!inode_create (FREE_MAP_SECTOR, bitmap_file_size (free_map)))
     PANIC ("free map creation failed");
 
-  /* Write bitmap to file. */
+  /* Write bitmap to file.  Writing all of it now also turns
+     every sector of the file into ordinary data, so that
+     free_map_flush(), which holds free_map_lock, never has to
+     allocate one. */
   free_map_file = file_open (inode_open (FREE_MAP_SECTOR));
   if (free_map_file == NULL)
     PANIC ("can't open free map");
   if (!bitmap_write (free_map, free_map_file))
     PANIC ("can't write free map");
+  bitmap_set_all (dirty_map, false);
+}
+
+/* Returns R's links in TREE. */
+static struct run_link *
+run_link (const struct run_tree *tree, struct free_run *r)
+{
+  return tree->by_size ? &r->size_link : &r->start_link;
+}
+
+/* Returns true if run A comes before run B in TREE. */
+static bool
+run_less (const struct run_tree *tree,
+          const struct free_run *a, const struct free_run *b)
+{
+  if (tree->by_size && a->length != b->length)
+    return a->length < b->length;
+  return a->start < b->start;
+}
+
+/* Recomputes R's max_length from R and its children, if TREE is
+   runs_by_start. */
+static void
+run_update (const struct run_tree *tree, struct free_run *r)
+{
+  struct free_run *left = r->start_link.left;
+  struct free_run *right = r->start_link.right;
+
+  if (tree->by_size)
+    return;
+  r->max_length = r->length;
+  if (left != NULL && left->max_length > r->max_length)
+    r->max_length = left->max_length;
+  if (right != NULL && right->max_length > r->max_length)
+    r->max_length = right->max_length;
+}
+
+/* Rotates the subtree of TREE rooted at R to bring R's left child
+   up if LEFT is true, otherwise its right child, and returns that
+   child, the new root of the subtree. */
+static struct free_run *
+run_rotate (const struct run_tree *tree, struct free_run *r, bool left)
+{
+  struct run_link *rl = run_link (tree, r);
+  struct free_run *c;
+
+  if (left)
+    {
+      c = rl->left;
+      rl->left = run_link (tree, c)->right;
+      run_link (tree, c)->right = r;
+    }
+  else
+    {
+      c = rl->right;
+      rl->right = run_link (tree, c)->left;
+      run_link (tree, c)->left = r;
+    }
+  run_update (tree, r);
+  run_update (tree, c);
+  return c;
+}
+
+/* Inserts run N into the subtree of TREE rooted at R, and returns
+   the new root of the subtree. */
+static struct free_run *
+tree_insert (const struct run_tree *tree, struct free_run *r,
+             struct free_run *n)
+{
+  struct run_link *rl;
+
+  if (r == NULL)
+    {
+      run_link (tree, n)->left = run_link (tree, n)->right = NULL;
+      run_update (tree, n);
+      return n;
+    }
+
+  rl = run_link (tree, r);
+  if (run_less (tree, n, r))
+    {
+      rl->left = tree_insert (tree, rl->left, n);
+      if (rl->left->priority > r->priority)
+        return run_rotate (tree, r, true);
+    }
+  else
+    {
+      rl->right = tree_insert (tree, rl->right, n);
+      if (rl->right->priority > r->priority)
+        return run_rotate (tree, r, false);
+    }
+  run_update (tree, r);
+  return r;
+}
+
+/* Removes run N from the subtree of TREE rooted at R, which must
+   contain it, and returns the new root of the subtree.  N is
+   rotated down until it has at most one child, then replaced by
+   that child. */
+static struct free_run *
+tree_remove (const struct run_tree *tree, struct free_run *r,
+             struct free_run *n)
+{
+  struct run_link *rl = run_link (tree, r);
+
+  if (r == n)
+    {
+      if (rl->left == NULL)
+        return rl->right;
+      if (rl->right == NULL)
+        return rl->left;
+      if (rl->left->priority > rl->right->priority)
+        {
+          r = run_rotate (tree, r, true);
+          rl = run_link (tree, r);
+          rl->right = tree_remove (tree, rl->right, n);
+        }
+      else
+        {
+          r = run_rotate (tree, r, false);
+          rl = run_link (tree, r);
+          rl->left = tree_remove (tree, rl->left, n);
+        }
+    }
+  else if (run_less (tree, n, r))
+    rl->left = tree_remove (tree, rl->left, n);
+  else
+    rl->right = tree_remove (tree, rl->right, n);
+  run_update (tree, r);
+  return r;
+}
+
+/* Recomputes max_length on the path from R, a node of
+   runs_by_start, down to run N, after N's length changed. */
+static void
+tree_fix (struct free_run *r, struct free_run *n)
+{
+  if (r != n)
+    tree_fix (n->start < r->start ? r->start_link.left : r->start_link.right,
+              n);
+  run_update (&runs_by_start, r);
+}
+
+/* Sets the extent of free run R to LENGTH sectors at START, or
+   discards R if LENGTH is 0.  A new START must not move R past
+   another run, so that R keeps its place in runs_by_start. */
+static void
+run_set (struct free_run *r, block_sector_t start, size_t length)
+{
+  runs_by_size.root = tree_remove (&runs_by_size, runs_by_size.root, r);
+  if (length == 0)
+    {
+      runs_by_start.root = tree_remove (&runs_by_start,
+                                        runs_by_start.root, r);
+      free (r);
+      return;
+    }
+  r->start = start;
+  r->length = length;
+  tree_fix (runs_by_start.root, r);
+  runs_by_size.root = tree_insert (&runs_by_size, runs_by_size.root, r);
+}
+
+/* Creates a free run of LENGTH sectors at START and adds it to
+   the index.  Returns false if out of memory. */
+static bool
+run_insert (block_sector_t start, size_t length)
+{
+  struct free_run *r = malloc (sizeof *r);
+  if (r == NULL)
+    return false;
+  r->start = start;
+  r->length = length;
+  r->priority = hash_int (start);
+  runs_by_start.root = tree_insert (&runs_by_start, runs_by_start.root, r);
+  runs_by_size.root = tree_insert (&runs_by_size, runs_by_size.root, r);
+  return true;
+}
+
+/* Discards the index and rebuilds it from the free map. */
+static void
+build_index (void)
+{
+  size_t size = bitmap_size (free_map);
+  size_t start, end;
+
+  for (start = 0; start < group_cnt; start++)
+    group_free[start] = 0;
+  while (runs_by_start.root != NULL)
+    run_set (runs_by_start.root, 0, 0);
+
+  for (start = 0; start < size; start = end)
+    {
+      start = bitmap_scan (free_map, start, 1, false);
+      if (start == BITMAP_ERROR)
+        break;
+      for (end = start + 1; end < size && !bitmap_test (free_map, end); end++)
+        continue;
+      if (!run_insert (start, end - start))
+        PANIC ("can't allocate free map index");
+      group_count (start, end - start, true);
+    }
+}
+
+/* Returns the free run with the greatest start at or before
+   SECTOR, or a null pointer if there is none. */
+static struct free_run *
+run_floor (block_sector_t sector)
+{
+  struct free_run *r = runs_by_start.root;
+  struct free_run *best = NULL;
+
+  while (r != NULL)
+    if (r->start <= sector)
+      {
+        best = r;
+        r = r->start_link.right;
+      }
+    else
+      r = r->start_link.left;
+  return best;
+}
+
+/* Returns the free run with the least start after SECTOR that is
+   at least CNT sectors long, searching the subtree of
+   runs_by_start rooted at R, or a null pointer if there is none.
+   Subtrees with no long enough run are skipped whole. */
+static struct free_run *
+run_first_after (struct free_run *r, block_sector_t sector, size_t cnt)
+{
+  if (r == NULL || r->max_length < cnt)
+    return NULL;
+  if (r->start > sector)
+    {
+      struct free_run *left = run_first_after (r->start_link.left,
+                                               sector, cnt);
+      if (left != NULL)
+        return left;
+      if (r->length >= cnt)
+        return r;
+    }
+  return run_first_after (r->start_link.right, sector, cnt);
+}
+
+/* Returns the shortest free run at least CNT sectors long,
+   preferring the lowest start among equals, or a null pointer if
+   there is none. */
+static struct free_run *
+find_best (size_t cnt)
+{
+  struct free_run *r = runs_by_size.root;
+  struct free_run *best = NULL;
+
+  while (r != NULL)
+    if (r->length >= cnt)
+      {
+        best = r;
+        r = r->size_link.left;
+      }
+    else
+      r = r->size_link.right;
+  return best;
+}
+
+/* Allocates the CNT sectors starting at SECTOR, which must lie
+   within free run R, and marks them in use.
+   Returns false if out of memory. */
+static bool
+take (struct free_run *r, block_sector_t sector, size_t cnt)
+{
+  block_sector_t end = r->start + r->length;
+
+  ASSERT (sector >= r->start && sector + cnt <= end);
+
+  /* Allocating from the middle of a run splits it in two. */
+  if (sector > r->start && sector + cnt < end)
+    {
+      if (!run_insert (sector + cnt, end - (sector + cnt)))
+        return false;
+      run_set (r, r->start, sector - r->start);
+    }
+  else if (sector > r->start)
+    run_set (r, r->start, r->length - cnt);
+  else
+    run_set (r, sector + cnt, r->length - cnt);
+
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  bitmap_set_multiple (dirty_map, sector / BITS_PER_SECTOR,
+                       (sector + cnt - 1) / BITS_PER_SECTOR
+                       - sector / BITS_PER_SECTOR + 1, true);
+  group_count (sector, cnt, false);
+  return true;
+}
+
+/* Adds the CNT sectors starting at SECTOR, just made free, to the
+   index, merging them with the runs on either side. */
+static void
+give_back (block_sector_t sector, size_t cnt)
+{
+  struct free_run *prev, *next;
+
+  group_count (sector, cnt, true);
+  prev = run_floor (sector);
+  next = run_floor (sector + cnt);
+  if (prev != NULL && prev->start + prev->length != sector)
+    prev = NULL;
+  if (next != NULL && next->start != sector + cnt)
+    next = NULL;
+
+  if (prev != NULL && next != NULL)
+    {
+      size_t length = prev->length + cnt + next->length;
+      run_set (next, 0, 0);
+      run_set (prev, prev->start, length);
+    }
+  else if (prev != NULL)
+    run_set (prev, prev->start, prev->length + cnt);
+  else if (next != NULL)
+    run_set (next, sector, next->length + cnt);
+  else if (!run_insert (sector, cnt))
+    {
+      /* Out of memory.  The sectors are free in the bitmap, so
+         they will be found again when the index is next rebuilt
+         from it, at the next mount. */
+    }
+}
+
+/* Adds CNT sectors starting at SECTOR to the free counts of the
+   block groups they lie in if FREED is true, or takes them away
+   if it is false. */
+static void
+group_count (block_sector_t sector, size_t cnt, bool freed)
+{
+  while (cnt > 0)
+    {
+      size_t g = sector / BLOCK_GROUP_SECTORS;
+      size_t n = (g + 1) * BLOCK_GROUP_SECTORS - sector;
+
+      if (n > cnt)
+        n = cnt;
+      if (freed)
+        group_free[g] += n;
+      else
+        group_free[g] -= n;
+      sector += n;
+      cnt -= n;
+    }
 }
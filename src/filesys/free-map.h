@@ -12,6 +12,13 @@ void free_map_open (void);
 void free_map_close (void);
 
 bool free_map_allocate (size_t, block_sector_t *);
+bool free_map_allocate_near (block_sector_t goal, size_t,
+                             block_sector_t *);
+size_t free_map_extend (block_sector_t, size_t);
 void free_map_release (block_sector_t, size_t);
+void free_map_flush (void);
+
+size_t free_map_group (block_sector_t);
+block_sector_t free_map_emptiest_group (void);
 
 #endif /* filesys/free-map.h */
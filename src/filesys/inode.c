@@ -1,23 +1,92 @@
 #include "filesys/inode.h"
 #include <list.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
+#include <stddef.h>
 #include <string.h>
+#include "filesys/cache.h"
+#include "filesys/directory.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of LENGTH consecutive sectors starting at START.
+
+   A file may be sparse.  An extent whose START is 0 is a hole,
+   with no sectors behind it at all (sector 0 holds the free map,
+   never file data).  An UNWRITTEN extent has its sectors
+   allocated, but they have never been written and may hold
+   anything.  Both read as zeros, and a sector of either becomes
+   ordinary data the first time it is written. */
+struct extent
+  {
+    block_sector_t start;               /* First sector, or 0 for a hole. */
+    uint32_t length : 31;               /* Number of sectors. */
+    uint32_t unwritten : 1;             /* Allocated but never written? */
+  };
+
+/* Returns true if E is a hole. */
+static inline bool
+extent_is_hole (const struct extent *e)
+{
+  return e->start == 0;
+}
+
+/* Returns true if E's sectors hold file data, that is, if E is
+   neither a hole nor unwritten. */
+static inline bool
+extent_is_data (const struct extent *e)
+{
+  return !extent_is_hole (e) && !e->unwritten;
+}
+
+/* A file's data lives in a list of extents, in file order.  The
+   first INODE_EXTENT_CNT are kept in the inode itself, the rest
+   in a chain of indirect blocks of INDIRECT_EXTENT_CNT each, so
+   that a file can have any number of extents.  A file that is
+   written sequentially usually needs only a few of them, because
+   growth first tries to extend the last extent in place. */
+#define INODE_EXTENT_CNT 61
+#define INDIRECT_EXTENT_CNT 63
+
+/* A file of at most INODE_INLINE_MAX bytes keeps its data in the
+   inode sector itself, in place of the extents, and has no data
+   sectors.  Opening it reads the one sector that holds both.  It
+   moves to a data sector the first time it outgrows the inode. */
+#define INODE_INLINE_MAX (INODE_EXTENT_CNT * sizeof (struct extent))
+
+/* Inode flags. */
+#define INODE_INLINE 0x1                /* Data is in the inode. */
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t flags;                     /* INODE_* flags. */
+    uint32_t sector_cnt;                /* # of sectors covered by extents. */
+    uint32_t extent_cnt;                /* # of extents in use. */
+    block_sector_t indirect;            /* First indirect block, or 0. */
+    union
+      {
+        struct extent extents[INODE_EXTENT_CNT]; /* First extents. */
+        uint8_t inline_data[INODE_INLINE_MAX];   /* If INODE_INLINE. */
+      };
+  };
+
+/* Indirect extent block.
+   Must be exactly BLOCK_SECTOR_SIZE bytes long. */
+struct indirect_block
+  {
+    struct extent extents[INDIRECT_EXTENT_CNT]; /* Further extents. */
+    block_sector_t next;                /* Next indirect block, or 0. */
+    uint32_t unused;                    /* Not used. */
   };
 
 /* Returns the number of sectors to allocate for an inode SIZE
@@ -31,37 +100,134 @@ bytes_to_sectors (off_t size)
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
+    struct hash_elem hash_elem;         /* Element in inode_table. */
+    struct list_elem elem;              /* Element in closed_inodes. */
     block_sector_t sector;              /* Sector number of disk location. */
     int open_cnt;                       /* Number of openers. */
+    bool loading;                       /* Still being read from disk? */
+    struct condition loaded;            /* Signaled when read in. */
     bool removed;                       /* True if deleted, false otherwise. */
+    struct rwlock rwlock;               /* Guards deny_write_cnt, data. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct dir_index *dir_index;        /* Directory name index, or null. */
     struct inode_disk data;             /* Inode content. */
   };
 
+static bool extent_get (const struct inode_disk *, size_t idx,
+                        struct extent *);
+static bool extent_set (struct inode_disk *, size_t idx,
+                        const struct extent *);
+static bool extent_insert (struct inode_disk *, size_t idx,
+                           const struct extent *);
+static void extent_remove (struct inode_disk *, size_t idx);
+static bool inode_grow (struct inode_disk *, block_sector_t inode_sector,
+                        size_t sectors, bool hole);
+static block_sector_t fill_sector (struct inode_disk *, block_sector_t goal,
+                                   size_t sector_idx, bool partial);
+static bool inode_uninline (struct inode *);
+static void inode_release_blocks (const struct inode_disk *);
+
+/* Finds the extent of D that covers data sector SECTOR_IDX of
+   the file.  On success, stores the extent into *E, its index
+   into *IDX and SECTOR_IDX's offset within it into *OFS, and
+   returns true.  Returns false if D has no such sector or memory
+   allocation fails. */
+static bool
+extent_find (const struct inode_disk *d, size_t sector_idx,
+             size_t *idx, struct extent *e, size_t *ofs)
+{
+  struct indirect_block *ib;
+  block_sector_t ib_sector;
+  bool found = false;
+  size_t i, n;
+
+  for (i = 0; i < d->extent_cnt && i < INODE_EXTENT_CNT; i++)
+    {
+      if (sector_idx < d->extents[i].length)
+        {
+          *idx = i;
+          *e = d->extents[i];
+          *ofs = sector_idx;
+          return true;
+        }
+      sector_idx -= d->extents[i].length;
+    }
+
+  /* Walk the indirect blocks. */
+  ib = malloc (sizeof *ib);
+  if (ib == NULL)
+    return false;
+  for (ib_sector = d->indirect; ib_sector != 0 && !found && i < d->extent_cnt;
+       ib_sector = ib->next)
+    {
+      cache_read (ib_sector, ib);
+      for (n = 0; n < INDIRECT_EXTENT_CNT && i < d->extent_cnt; n++, i++)
+        {
+          if (sector_idx < ib->extents[n].length)
+            {
+              *idx = i;
+              *e = ib->extents[n];
+              *ofs = sector_idx;
+              found = true;
+              break;
+            }
+          sector_idx -= ib->extents[n].length;
+        }
+    }
+  free (ib);
+  return found;
+}
+
 /* Returns the block device sector that contains byte offset POS
-   within INODE.
+   within INODE, or 0 if POS lies in a hole or an unwritten extent
+   and so reads as zeros.
    Returns -1 if INODE does not contain data for a byte at offset
    POS. */
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
+  struct extent e;
+  size_t idx, ofs;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  if (pos >= inode->data.length
+      || !extent_find (&inode->data, pos / BLOCK_SECTOR_SIZE,
+                       &idx, &e, &ofs))
     return -1;
+  return extent_is_data (&e) ? e.start + ofs : 0;
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Table of in-memory inodes, keyed by sector, so that opening a
+   single inode twice returns the same `struct inode'.  Besides the
+   open inodes, it holds up to CLOSED_INODE_MAX inodes whose last
+   opener has closed them, kept on closed_inodes in least recently
+   closed order, so that reopening a file soon after closing it does
+   not have to read its inode again.  An in-memory inode is never
+   dirty: inode_write_at() writes every change through to the
+   buffer cache, so a closed inode can be dropped at any time. */
+static struct hash inode_table;
+static struct list closed_inodes;
+static size_t closed_cnt;
+#define CLOSED_INODE_MAX 64
+
+/* Protects inode_table, closed_inodes, closed_cnt and the
+   open_cnt, removed and loading members of every inode.  Never
+   held across disk I/O. */
+static struct lock inode_table_lock;
+
+static unsigned inode_hash (const struct hash_elem *, void *aux);
+static bool inode_less (const struct hash_elem *, const struct hash_elem *,
+                        void *aux);
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  ASSERT (sizeof (struct indirect_block) == BLOCK_SECTOR_SIZE);
+  if (!hash_init (&inode_table, inode_hash, inode_less, NULL))
+    PANIC ("can't allocate inode table");
+  list_init (&closed_inodes);
+  lock_init (&inode_table_lock);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
@@ -84,22 +250,19 @@ inode_create (block_sector_t sector, off_t length)
   disk_inode = calloc (1, sizeof *disk_inode);
   if (disk_inode != NULL)
     {
-      size_t sectors = bytes_to_sectors (length);
       disk_inode->length = length;
       disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
+      if (length <= (off_t) INODE_INLINE_MAX)
+        disk_inode->flags = INODE_INLINE;
+      if ((disk_inode->flags & INODE_INLINE)
+          || inode_grow (disk_inode, sector, bytes_to_sectors (length),
+                         false)) 
         {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
+          cache_write (sector, disk_inode);
           success = true; 
         } 
+      else
+        inode_release_blocks (disk_inode);
       free (disk_inode);
     }
   return success;
@@ -107,37 +270,64 @@ inode_create (block_sector_t sector, off_t length)
 
 /* Reads an inode from SECTOR
    and returns a `struct inode' that contains it.
-   Returns a null pointer if memory allocation fails. */
+   Returns a null pointer if memory allocation fails.
+
+   The inode goes into inode_table before it is read, marked as
+   loading, so that inode_table_lock is not held across the disk
+   read.  Anyone else who opens it meanwhile waits for the read
+   to finish. */
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
+  struct inode key;
+  struct hash_elem *e;
   struct inode *inode;
 
-  /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  lock_acquire (&inode_table_lock);
+
+  /* Check whether this inode is already in memory. */
+  key.sector = sector;
+  e = hash_find (&inode_table, &key.hash_elem);
+  if (e != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
+      inode = hash_entry (e, struct inode, hash_elem);
+      if (inode->open_cnt++ == 0)
         {
-          inode_reopen (inode);
-          return inode; 
+          list_remove (&inode->elem);
+          closed_cnt--;
         }
+      while (inode->loading)
+        cond_wait (&inode->loaded, &inode_table_lock);
+      lock_release (&inode_table_lock);
+      return inode;
     }
 
   /* Allocate memory. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      lock_release (&inode_table_lock);
+      return NULL;
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
   inode->sector = sector;
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  rwlock_init (&inode->rwlock);
+  inode->dir_index = NULL;
+  inode->loading = true;
+  cond_init (&inode->loaded);
+  hash_insert (&inode_table, &inode->hash_elem);
+  lock_release (&inode_table_lock);
+
+  cache_read (inode->sector, &inode->data);
+
+  lock_acquire (&inode_table_lock);
+  inode->loading = false;
+  cond_broadcast (&inode->loaded, &inode_table_lock);
+  lock_release (&inode_table_lock);
   return inode;
 }
 
@@ -146,7 +336,12 @@ struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      lock_acquire (&inode_table_lock);
+      ASSERT (inode->open_cnt > 0);
+      inode->open_cnt++;
+      lock_release (&inode_table_lock);
+    }
   return inode;
 }
 
@@ -157,41 +352,93 @@ inode_get_inumber (const struct inode *inode)
   return inode->sector;
 }
 
+/* Drops INODE from memory. */
+static void
+inode_free (struct inode *inode)
+{
+  hash_delete (&inode_table, &inode->hash_elem);
+  dir_index_destroy (inode->dir_index);
+  free (inode);
+}
+
 /* Closes INODE and writes it to disk.
-   If this was the last reference to INODE, frees its memory.
-   If INODE was also a removed inode, frees its blocks. */
+   If this was the last reference to INODE, moves it to the list
+   of closed inodes, dropping the least recently closed one if the
+   list is full.
+   If INODE was also a removed inode, frees its blocks and its
+   memory at once.  That reads its indirect blocks, so it is done
+   after taking INODE out of inode_table and dropping
+   inode_table_lock. */
 void
 inode_close (struct inode *inode) 
 {
+  bool release = false;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
+  lock_acquire (&inode_table_lock);
+
   /* Release resources if this was the last opener. */
   if (--inode->open_cnt == 0)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          hash_delete (&inode_table, &inode->hash_elem);
+          release = true;
         }
+      else
+        {
+          list_push_back (&closed_inodes, &inode->elem);
+          if (++closed_cnt > CLOSED_INODE_MAX)
+            {
+              struct list_elem *e = list_pop_front (&closed_inodes);
+              closed_cnt--;
+              inode_free (list_entry (e, struct inode, elem));
+            }
+        }
+    }
 
-      free (inode); 
+  lock_release (&inode_table_lock);
+
+  if (release)
+    {
+      free_map_release (inode->sector, 1);
+      inode_release_blocks (&inode->data);
+      dir_index_destroy (inode->dir_index);
+      free (inode);
     }
 }
 
+/* Returns the directory name index attached to INODE, or a null
+   pointer if none has been built yet. */
+struct dir_index *
+inode_get_dir_index (const struct inode *inode)
+{
+  return inode->dir_index;
+}
+
+/* Attaches directory name index INDEX to INODE.  The index stays
+   with INODE while it waits, closed, on the LRU list, and is
+   destroyed only when INODE is evicted from there or removed. */
+void
+inode_set_dir_index (struct inode *inode, struct dir_index *index)
+{
+  ASSERT (inode->dir_index == NULL);
+  inode->dir_index = index;
+}
+
 /* Marks INODE to be deleted when it is closed by the last caller who
    has it open. */
 void
 inode_remove (struct inode *inode) 
 {
   ASSERT (inode != NULL);
+  lock_acquire (&inode_table_lock);
   inode->removed = true;
+  lock_release (&inode_table_lock);
 }
 
 /* Reads SIZE bytes from INODE into BUFFER, starting at position OFFSET.
@@ -202,8 +449,19 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
+  rwlock_acquire_read (&inode->rwlock);
+  if (inode->data.flags & INODE_INLINE)
+    {
+      /* The data came in with the inode. */
+      off_t inode_left = inode->data.length - offset;
+      if (size > 0 && inode_left > 0)
+        {
+          bytes_read = size < inode_left ? size : inode_left;
+          memcpy (buffer, inode->data.inline_data + offset, bytes_read);
+        }
+      size = 0;
+    }
   while (size > 0) 
     {
       /* Disk sector to read, starting byte offset within sector. */
@@ -211,7 +469,7 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -220,59 +478,128 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
-        {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
-        }
-      else 
-        {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
-        }
+      /* Copy the chunk out of the buffer cache.  A never-written
+         sector reads as zeros without touching the disk. */
+      if (sector_idx == 0)
+        memset (buffer + bytes_read, 0, chunk_size);
+      else
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
       
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
+  rwlock_release_read (&inode->rwlock);
 
   return bytes_read;
 }
 
+/* Starts reading the sectors that hold bytes OFFSET through
+   OFFSET + SIZE - 1 of INODE into the buffer cache, without
+   waiting for them.  Bytes past the end of INODE are ignored. */
+void
+inode_prefetch (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  rwlock_acquire_read (&inode->rwlock);
+  if (inode->data.flags & INODE_INLINE)
+    end = 0;
+  else if (end > inode->data.length)
+    end = inode->data.length;
+  for (offset -= offset % BLOCK_SECTOR_SIZE; offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    {
+      block_sector_t sector = byte_to_sector (inode, offset);
+      if (sector != 0 && sector != (block_sector_t) -1)
+        cache_prefetch (sector);
+    }
+  rwlock_release_read (&inode->rwlock);
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk is full or an error occurs.  A write
+   past end of file extends the inode, and any gap before OFFSET
+   reads back as zeros.
+
+   Writes within the file share INODE's lock with readers and
+   other such writes; the buffer cache keeps each sector
+   consistent.  A write that extends the file, or that is the
+   first to a sector in a hole or unwritten extent, holds the lock
+   exclusively, so that no reader sees a new length or extent
+   before the data, as does any write to a file whose data is
+   still in its inode. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
-  uint8_t *bounce = NULL;
+  bool exclusive, changed = false;
+
+  rwlock_acquire_read (&inode->rwlock);
+  exclusive = size > 0 && (offset + size > inode->data.length
+                           || (inode->data.flags & INODE_INLINE));
+  if (exclusive)
+    {
+      rwlock_release_read (&inode->rwlock);
+      rwlock_acquire_write (&inode->rwlock);
+    }
 
   if (inode->deny_write_cnt)
-    return 0;
+    goto done;
+
+  /* Write a small file in its inode, or move it out to a data
+     sector if it no longer fits. */
+  if (size > 0 && (inode->data.flags & INODE_INLINE))
+    {
+      if (offset + size <= (off_t) INODE_INLINE_MAX)
+        {
+          memcpy (inode->data.inline_data + offset, buffer, size);
+          if (offset + size > inode->data.length)
+            inode->data.length = offset + size;
+          bytes_written = size;
+          changed = true;
+          goto done;
+        }
+      if (!inode_uninline (inode))
+        goto done;
+      changed = true;
+    }
+
+  /* Grow the file if the write goes past its end, leaving a hole
+     over any gap between the old end and OFFSET.  If the disk
+     fills up, grow it as far as possible. */
+  if (exclusive && offset + size > inode->data.length)
+    {
+      struct inode_disk *d = &inode->data;
+      size_t first = offset / BLOCK_SECTOR_SIZE;
+      size_t need = bytes_to_sectors (offset + size);
+      off_t length = offset + size;
+
+      if (first > d->sector_cnt
+          && !inode_grow (d, inode->sector, first - d->sector_cnt, true))
+        length = (off_t) d->sector_cnt * BLOCK_SECTOR_SIZE;
+      else if (need > d->sector_cnt
+               && !inode_grow (d, inode->sector, need - d->sector_cnt,
+                               false))
+        length = (off_t) d->sector_cnt * BLOCK_SECTOR_SIZE;
+      if (length > d->length)
+        d->length = length;
+      changed = true;
+    }
 
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
-      block_sector_t sector_idx = byte_to_sector (inode, offset);
+      block_sector_t sector_idx;
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
       /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      off_t inode_left = inode->data.length - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,39 +608,48 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      /* Give a never-written sector a place on disk first.  That
+         changes INODE's extents, so it takes the lock exclusively,
+         and then looks again in case another writer got there
+         first. */
+      sector_idx = byte_to_sector (inode, offset);
+      if (sector_idx == 0 && !exclusive)
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
+          rwlock_release_read (&inode->rwlock);
+          rwlock_acquire_write (&inode->rwlock);
+          exclusive = true;
+          sector_idx = byte_to_sector (inode, offset);
         }
-      else 
+      if (sector_idx == 0)
         {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
-            {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
-            }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
-          memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          sector_idx = fill_sector (&inode->data, inode->sector + 1,
+                                    offset / BLOCK_SECTOR_SIZE,
+                                    chunk_size < BLOCK_SECTOR_SIZE);
+          if (sector_idx == 0)
+            break;
+          changed = true;
         }
+      else if (sector_idx == (block_sector_t) -1)
+        break;
+
+      /* Copy the chunk into the buffer cache.  It reads in the
+         rest of the sector first, unless the chunk covers it all. */
+      cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                      chunk_size);
 
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_written += chunk_size;
     }
-  free (bounce);
 
+ done:
+  if (changed)
+    cache_write (inode->sector, &inode->data);
+  if (exclusive)
+    rwlock_release_write (&inode->rwlock);
+  else
+    rwlock_release_read (&inode->rwlock);
   return bytes_written;
 }
 
@@ -322,8 +658,10 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
 void
 inode_deny_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   inode->deny_write_cnt++;
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
+  rwlock_release_write (&inode->rwlock);
 }
 
 /* Re-enables writes to INODE.
@@ -332,14 +670,545 @@ inode_deny_write (struct inode *inode)
 void
 inode_allow_write (struct inode *inode) 
 {
+  rwlock_acquire_write (&inode->rwlock);
   ASSERT (inode->deny_write_cnt > 0);
   ASSERT (inode->deny_write_cnt <= inode->open_cnt);
   inode->deny_write_cnt--;
+  rwlock_release_write (&inode->rwlock);
 }
 
-/* Returns the length, in bytes, of INODE's data. */
+/* Returns the length, in bytes, of INODE's data.  This is only a
+   snapshot: without INODE's lock, the length may change as soon
+   as it is returned, but it is read in a single load, so it is
+   always some length the file really had. */
 off_t
 inode_length (const struct inode *inode)
 {
   return inode->data.length;
 }
+
+/* Stores the IDX'th extent of D into *E.  Returns false if D has
+   no such extent or an indirect block could not be read. */
+static bool
+extent_get (const struct inode_disk *d, size_t idx, struct extent *e)
+{
+  block_sector_t ib_sector = d->indirect;
+
+  if (idx >= d->extent_cnt)
+    return false;
+  if (idx < INODE_EXTENT_CNT)
+    {
+      *e = d->extents[idx];
+      return true;
+    }
+
+  /* Find the indirect block holding it, then just that extent. */
+  for (idx -= INODE_EXTENT_CNT; idx >= INDIRECT_EXTENT_CNT;
+       idx -= INDIRECT_EXTENT_CNT)
+    cache_read_at (ib_sector, &ib_sector,
+                   offsetof (struct indirect_block, next), sizeof ib_sector);
+  cache_read_at (ib_sector, e, idx * sizeof *e, sizeof *e);
+  return true;
+}
+
+/* Makes *E the IDX'th extent of D, where IDX is at most D's
+   number of extents, so that this either replaces an extent or
+   appends one.  Allocates a new indirect block if needed.
+   Returns false if out of disk space. */
+static bool
+extent_set (struct inode_disk *d, size_t idx, const struct extent *e)
+{
+  ASSERT (idx <= d->extent_cnt);
+
+  if (idx < INODE_EXTENT_CNT)
+    d->extents[idx] = *e;
+  else
+    {
+      /* Walk to the indirect block for it.  PREV is the block that
+         links to IB_SECTOR, or 0 if D does. */
+      size_t i = idx - INODE_EXTENT_CNT;
+      block_sector_t prev = 0;
+      block_sector_t ib_sector = d->indirect;
+
+      for (;;)
+        {
+          if (ib_sector == 0)
+            {
+              /* Appending the first extent of a new block. */
+              static const struct indirect_block empty;
+
+              ASSERT (i == 0 && idx == d->extent_cnt);
+              if (!free_map_allocate (1, &ib_sector))
+                return false;
+              cache_write (ib_sector, &empty);
+              if (prev == 0)
+                d->indirect = ib_sector;
+              else
+                cache_write_at (prev, &ib_sector,
+                                offsetof (struct indirect_block, next),
+                                sizeof ib_sector);
+            }
+          if (i < INDIRECT_EXTENT_CNT)
+            break;
+          i -= INDIRECT_EXTENT_CNT;
+          prev = ib_sector;
+          cache_read_at (prev, &ib_sector,
+                         offsetof (struct indirect_block, next),
+                         sizeof ib_sector);
+        }
+      cache_write_at (ib_sector, e, i * sizeof *e, sizeof *e);
+    }
+
+  if (idx == d->extent_cnt)
+    d->extent_cnt++;
+  return true;
+}
+
+/* Moves extents E[FIRST] through E[END - 2] up by one, puts
+   *CARRY in E[FIRST], and stores the old E[END - 1], which moves
+   on to the next block, into *CARRY. */
+static void
+shift_up (struct extent e[], size_t first, size_t end, struct extent *carry)
+{
+  struct extent out = e[end - 1];
+
+  memmove (&e[first + 1], &e[first], (end - first - 1) * sizeof *e);
+  e[first] = *carry;
+  *carry = out;
+}
+
+/* Moves extents E[FIRST + 1] through E[END - 1] down by one,
+   leaving E[END - 1] for the caller to fill in. */
+static void
+shift_down (struct extent e[], size_t first, size_t end)
+{
+  memmove (&e[first], &e[first + 1], (end - first - 1) * sizeof *e);
+}
+
+/* Writes zeros to CNT sectors starting at SECTOR. */
+static void
+zero_sectors (block_sector_t sector, size_t cnt)
+{
+  static const char zeros[BLOCK_SECTOR_SIZE];
+
+  while (cnt-- > 0)
+    cache_write (sector++, zeros);
+}
+
+/* Inserts *E as the IDX'th extent of D, moving the extents from
+   IDX onward up by one.  Returns false if out of disk space or
+   memory, in which case D is unchanged.
+   The extents move a block at a time: each indirect block from
+   the one holding IDX onward is read and written once, its last
+   extent carried over to the start of the next. */
+static bool
+extent_insert (struct inode_disk *d, size_t idx, const struct extent *e)
+{
+  struct indirect_block *ib = NULL;
+  struct extent carry = *e, last;
+  block_sector_t ib_sector;
+  size_t base;
+
+  ASSERT (idx <= d->extent_cnt);
+
+  if (idx == d->extent_cnt)
+    return extent_set (d, idx, e);
+
+  /* Allocating is the only step that can fail, so do it first:
+     the buffer for indirect blocks, if any will be touched, and
+     one more extent at the end, which the shift then overwrites. */
+  if (d->extent_cnt >= INODE_EXTENT_CNT)
+    {
+      ib = malloc (sizeof *ib);
+      if (ib == NULL)
+        return false;
+    }
+  extent_get (d, d->extent_cnt - 1, &last);
+  if (!extent_set (d, d->extent_cnt, &last))
+    {
+      free (ib);
+      return false;
+    }
+
+  if (idx < INODE_EXTENT_CNT)
+    shift_up (d->extents, idx, d->extent_cnt < INODE_EXTENT_CNT
+              ? d->extent_cnt : INODE_EXTENT_CNT, &carry);
+  for (base = INODE_EXTENT_CNT, ib_sector = d->indirect;
+       base < d->extent_cnt; base += INDIRECT_EXTENT_CNT)
+    if (idx < base + INDIRECT_EXTENT_CNT)
+      {
+        size_t end = d->extent_cnt - base;
+
+        cache_read (ib_sector, ib);
+        shift_up (ib->extents, idx > base ? idx - base : 0,
+                  end < INDIRECT_EXTENT_CNT ? end : INDIRECT_EXTENT_CNT,
+                  &carry);
+        cache_write (ib_sector, ib);
+        ib_sector = ib->next;
+      }
+    else
+      cache_read_at (ib_sector, &ib_sector,
+                     offsetof (struct indirect_block, next),
+                     sizeof ib_sector);
+  free (ib);
+  return true;
+}
+
+/* Removes the IDX'th extent of D, moving the extents after it
+   down by one, a block at a time as in extent_insert(); the first
+   extent of each block moves to the end of the block before.
+   Indirect blocks that fall out of use are kept for later growth,
+   and freed with the inode. */
+static void
+extent_remove (struct inode_disk *d, size_t idx)
+{
+  struct indirect_block *ib = NULL;
+  block_sector_t ib_sector;
+  size_t cnt = d->extent_cnt;
+  size_t base;
+
+  ASSERT (idx < cnt);
+
+  if (cnt > INODE_EXTENT_CNT && (ib = malloc (sizeof *ib)) == NULL)
+    {
+      /* Removing cannot fail, so fall back to moving the extents
+         one at a time. */
+      struct extent tmp;
+      size_t i;
+
+      for (i = idx; i + 1 < cnt; i++)
+        {
+          extent_get (d, i + 1, &tmp);
+          extent_set (d, i, &tmp);
+        }
+      d->extent_cnt--;
+      return;
+    }
+
+  if (idx < INODE_EXTENT_CNT)
+    {
+      size_t end = cnt < INODE_EXTENT_CNT ? cnt : INODE_EXTENT_CNT;
+
+      shift_down (d->extents, idx, end);
+      if (end < cnt)
+        cache_read_at (d->indirect, &d->extents[end - 1], 0,
+                       sizeof *d->extents);
+    }
+  for (base = INODE_EXTENT_CNT, ib_sector = d->indirect; base < cnt;
+       base += INDIRECT_EXTENT_CNT)
+    if (idx < base + INDIRECT_EXTENT_CNT)
+      {
+        size_t end = cnt - base < INDIRECT_EXTENT_CNT
+                     ? cnt - base : INDIRECT_EXTENT_CNT;
+
+        cache_read (ib_sector, ib);
+        shift_down (ib->extents, idx > base ? idx - base : 0, end);
+        if (base + end < cnt)
+          cache_read_at (ib->next, &ib->extents[end - 1], 0,
+                         sizeof *ib->extents);
+        cache_write (ib_sector, ib);
+        ib_sector = ib->next;
+      }
+    else
+      cache_read_at (ib_sector, &ib_sector,
+                     offsetof (struct indirect_block, next),
+                     sizeof ib_sector);
+  free (ib);
+  d->extent_cnt--;
+}
+
+/* The first NEAR_SECTORS sectors of a file are placed right
+   after its inode, in its directory's block group.  Past that, as
+   in FFS, a file that would go on growing in that group moves to
+   the emptiest group instead, if that is another one, so that one
+   large file does not use up the space near the directory that
+   its other files want. */
+#define NEAR_SECTORS 64
+
+/* Adds SECTORS sectors to the end of D, the inode in sector
+   INODE_SECTOR, as a hole if HOLE is true, otherwise as unwritten
+   sectors: allocated, so that the disk cannot fill up under them
+   later, but not zeroed, so that this costs only the metadata.
+   Extends D's last extent in place when it is of the same kind
+   and the free map allows, and puts the rest in new extents, each
+   as long as can be found, placed as described above.
+   Returns false if the disk fills up first, in which case
+   D keeps the sectors added so far. */
+static bool
+inode_grow (struct inode_disk *d, block_sector_t inode_sector,
+            size_t sectors, bool hole)
+{
+  block_sector_t goal = inode_sector + 1;
+
+  while (sectors > 0)
+    {
+      struct extent e;
+      bool have_last = extent_get (d, d->extent_cnt - 1, &e);
+      size_t n, want = sectors;
+
+      if (have_last && !extent_is_hole (&e))
+        goal = e.start + e.length;
+
+      if (hole)
+        {
+          n = sectors;
+          if (have_last && extent_is_hole (&e))
+            {
+              e.length += n;
+              extent_set (d, d->extent_cnt - 1, &e);
+            }
+          else
+            {
+              e.start = 0;
+              e.length = n;
+              e.unwritten = false;
+              if (!extent_set (d, d->extent_cnt, &e))
+                return false;
+            }
+          d->sector_cnt += n;
+          sectors -= n;
+          continue;
+        }
+
+      /* Choose where to put the next sectors. */
+      if (d->sector_cnt < NEAR_SECTORS)
+        {
+          if (want > NEAR_SECTORS - d->sector_cnt)
+            want = NEAR_SECTORS - d->sector_cnt;
+        }
+      else if (free_map_group (goal) == free_map_group (inode_sector))
+        {
+          block_sector_t spread = free_map_emptiest_group ();
+          if (free_map_group (spread) != free_map_group (goal))
+            goal = spread;
+        }
+
+      if (have_last && e.unwritten && goal == e.start + e.length
+          && (n = free_map_extend (goal, want)) > 0)
+        {
+          /* Extend the last extent in place. */
+          e.length += n;
+          extent_set (d, d->extent_cnt - 1, &e);
+        }
+      else
+        {
+          /* Start a new extent, as long as possible. */
+          for (n = want; !free_map_allocate_near (goal, n, &e.start); n /= 2)
+            if (n == 1)
+              return false;
+          e.length = n;
+          e.unwritten = true;
+          if (!extent_set (d, d->extent_cnt, &e))
+            {
+              free_map_release (e.start, n);
+              return false;
+            }
+        }
+      d->sector_cnt += n;
+      sectors -= n;
+    }
+  return true;
+}
+
+/* Turns data sector SECTOR_IDX of D, which lies in a hole or an
+   unwritten extent, into an ordinary data sector, and returns the
+   device sector that now holds it.  A sector in a hole is
+   allocated, right after the previous extent or right before the
+   next one if possible, or else near GOAL.  If PARTIAL is true,
+   the caller is about to write only part of the sector, so the
+   rest is zeroed first.
+   The sector joins the previous extent when it directly follows
+   it on disk, as it does when a file is written in order, or the
+   next extent when it directly precedes it, as when a file is
+   written backward, and both if it fills the gap between them;
+   otherwise its extent is split around it.
+   Returns 0 if the disk is full. */
+static block_sector_t
+fill_sector (struct inode_disk *d, block_sector_t goal, size_t sector_idx,
+             bool partial)
+{
+  struct extent e, prev, next, data, after;
+  bool have_prev, have_next;
+  block_sector_t sector;
+  size_t idx, ofs;
+
+  if (!extent_find (d, sector_idx, &idx, &e, &ofs))
+    return 0;
+  ASSERT (!extent_is_data (&e));
+
+  have_prev = (ofs == 0 && idx > 0 && extent_get (d, idx - 1, &prev)
+               && extent_is_data (&prev));
+  have_next = (ofs + 1 == e.length && extent_get (d, idx + 1, &next)
+               && extent_is_data (&next));
+
+  /* Find the sector a place on disk. */
+  if (e.unwritten)
+    sector = e.start + ofs;
+  else if (have_prev && free_map_extend (prev.start + prev.length, 1) == 1)
+    sector = prev.start + prev.length;
+  else if (!free_map_allocate_near (have_next && next.start > 1
+                                    ? next.start - 1
+                                    : have_prev ? prev.start + prev.length
+                                    : goal, 1, &sector))
+    return 0;
+  if (partial)
+    zero_sectors (sector, 1);
+
+  if (have_prev && prev.start + prev.length == sector)
+    {
+      /* Join the previous extent and shrink E from the front.  If
+         that empties E and the next extent follows on disk, the
+         previous one takes it in as well. */
+      prev.length++;
+      if (!extent_is_hole (&e))
+        e.start++;
+      if (--e.length > 0)
+        extent_set (d, idx, &e);
+      else if (have_next && next.start == sector + 1)
+        {
+          prev.length += next.length;
+          extent_remove (d, idx + 1);
+          extent_remove (d, idx);
+        }
+      else
+        extent_remove (d, idx);
+      extent_set (d, idx - 1, &prev);
+      return sector;
+    }
+  if (have_next && next.start == sector + 1)
+    {
+      /* Join the next extent and shrink E from the back. */
+      next.start--;
+      next.length++;
+      extent_set (d, idx + 1, &next);
+      if (--e.length == 0)
+        extent_remove (d, idx);
+      else
+        extent_set (d, idx, &e);
+      return sector;
+    }
+
+  /* Split E into the part before the sector, the sector itself
+     and the part after it, dropping the parts that are empty. */
+  data.start = sector;
+  data.length = 1;
+  data.unwritten = false;
+  after = e;
+  after.length = e.length - ofs - 1;
+  if (!extent_is_hole (&e))
+    after.start = e.start + ofs + 1;
+  e.length = ofs;
+
+  if (after.length > 0 && !extent_insert (d, idx + 1, &after))
+    goto fail;
+  if (e.length > 0)
+    {
+      if (!extent_insert (d, idx + 1, &data))
+        {
+          if (after.length > 0)
+            extent_remove (d, idx + 1);
+          goto fail;
+        }
+      extent_set (d, idx, &e);
+    }
+  else
+    extent_set (d, idx, &data);
+  return sector;
+
+ fail:
+  if (extent_is_hole (&e))
+    free_map_release (sector, 1);
+  return 0;
+}
+
+/* Moves the data of INODE, which must be in the inode itself,
+   out to a data sector of its own, so that the file can grow
+   past INODE_INLINE_MAX bytes.  Since INODE_INLINE_MAX is less
+   than a sector, one sector always holds it.  Returns false if
+   the disk is full, leaving INODE unchanged.  The caller must
+   hold INODE's lock exclusively, and write INODE back. */
+static bool
+inode_uninline (struct inode *inode)
+{
+  struct inode_disk *d = &inode->data;
+  struct extent e;
+
+  ASSERT (d->flags & INODE_INLINE);
+
+  e.length = 0;
+  if (d->length > 0)
+    {
+      if (!free_map_allocate_near (inode->sector + 1, 1, &e.start))
+        return false;
+      zero_sectors (e.start, 1);
+      cache_write_at (e.start, d->inline_data, 0, d->length);
+      e.length = 1;
+      e.unwritten = false;
+    }
+
+  d->flags &= ~INODE_INLINE;
+  memset (d->extents, 0, sizeof d->extents);
+  d->extent_cnt = 0;
+  d->sector_cnt = 0;
+  if (e.length > 0)
+    {
+      extent_set (d, 0, &e);
+      d->sector_cnt = 1;
+    }
+  return true;
+}
+
+/* Frees the sectors of extent E, if it has any. */
+static void
+extent_release (const struct extent *e)
+{
+  if (!extent_is_hole (e))
+    free_map_release (e->start, e->length);
+}
+
+/* Frees the data sectors and indirect blocks of D. */
+static void
+inode_release_blocks (const struct inode_disk *d)
+{
+  block_sector_t ib_sector = d->indirect;
+  size_t left = d->extent_cnt;
+  size_t i;
+
+  if (d->flags & INODE_INLINE)
+    return;
+  for (i = 0; left > 0 && i < INODE_EXTENT_CNT; i++, left--)
+    extent_release (&d->extents[i]);
+
+  while (ib_sector != 0)
+    {
+      struct indirect_block *ib = malloc (sizeof *ib);
+      block_sector_t next;
+
+      if (ib == NULL)
+        break;
+      cache_read (ib_sector, ib);
+      for (i = 0; left > 0 && i < INDIRECT_EXTENT_CNT; i++, left--)
+        extent_release (&ib->extents[i]);
+      next = ib->next;
+      free (ib);
+      free_map_release (ib_sector, 1);
+      ib_sector = next;
+    }
+}
+
+/* Returns a hash value for inode E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct inode *inode = hash_entry (e, struct inode, hash_elem);
+  return hash_int (inode->sector);
+}
+
+/* Returns true if inode A's sector precedes inode B's. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode, hash_elem)->sector
+          < hash_entry (b, struct inode, hash_elem)->sector);
+}
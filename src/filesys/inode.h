@@ -6,6 +6,7 @@
 #include "devices/block.h"
 
 struct bitmap;
+struct dir_index;
 
 void inode_init (void);
 bool inode_create (block_sector_t, off_t);
@@ -14,6 +15,9 @@ struct inode *inode_reopen (struct inode *);
 block_sector_t inode_get_inumber (const struct inode *);
 void inode_close (struct inode *);
 void inode_remove (struct inode *);
+struct dir_index *inode_get_dir_index (const struct inode *);
+void inode_set_dir_index (struct inode *, struct dir_index *);
+void inode_prefetch (struct inode *, off_t offset, off_t size);
 off_t inode_read_at (struct inode *, void *, off_t size, off_t offset);
 off_t inode_write_at (struct inode *, const void *, off_t size, off_t offset);
 void inode_deny_write (struct inode *);
@@ -182,3 +182,9 @@ inumber (int fd)
 {
   return syscall1 (SYS_INUMBER, fd);
 }
+
+bool
+settickets (int tickets) 
+{
+  return syscall1 (SYS_SETTICKETS, tickets);
+}
@@ -0,0 +1,90 @@
+/* Tests cond_wait_timeout().
+
+   A waiter that times out while another thread holds the lock
+   stays on the condition's list, no longer blocked on its
+   semaphore, until it gets the lock back.  A signal sent in that
+   window must go to a thread that is still waiting rather than
+   be spent on the one that gave up, unless that one is the only
+   waiter, in which case it takes the late signal when it gets
+   the lock back.  A signal before the deadline must win. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func cond_timeout_thread;
+static thread_func cond_wait_thread;
+static struct lock lock;
+static struct condition condition;
+
+void
+test_cond_timeout (void) 
+{
+  static int64_t short_wait = 10;
+  static int64_t long_wait = 1000;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  lock_init (&lock);
+  cond_init (&condition);
+
+  /* A waiter that times out, then a late signal that must go to
+     the thread still waiting. */
+  thread_create ("timeout 1", PRI_DEFAULT + 2, cond_timeout_thread,
+                 &short_wait);
+  thread_create ("waiter", PRI_DEFAULT + 1, cond_wait_thread, NULL);
+  lock_acquire (&lock);
+  timer_sleep (50);
+  msg ("Signaling...");
+  cond_signal (&condition, &lock);
+  lock_release (&lock);
+  msg ("%zu waiters left.", list_size (&condition.waiters));
+
+  /* A waiter that times out, then a late signal with no one else
+     waiting. */
+  thread_create ("timeout 2", PRI_DEFAULT + 2, cond_timeout_thread,
+                 &short_wait);
+  lock_acquire (&lock);
+  timer_sleep (50);
+  msg ("Signaling...");
+  cond_signal (&condition, &lock);
+  lock_release (&lock);
+  msg ("%zu waiters left.", list_size (&condition.waiters));
+
+  /* A signal before the deadline. */
+  thread_create ("timeout 3", PRI_DEFAULT + 2, cond_timeout_thread,
+                 &long_wait);
+  lock_acquire (&lock);
+  msg ("Signaling...");
+  cond_signal (&condition, &lock);
+  lock_release (&lock);
+  msg ("%zu waiters left.", list_size (&condition.waiters));
+}
+
+static void
+cond_timeout_thread (void *ticks_) 
+{
+  int64_t *ticks = ticks_;
+  bool signaled;
+
+  lock_acquire (&lock);
+  msg ("Thread %s waiting %"PRId64" ticks.", thread_name (), *ticks);
+  signaled = cond_wait_timeout (&condition, &lock, *ticks);
+  msg ("Thread %s %s.", thread_name (), signaled ? "woke up" : "timed out");
+  lock_release (&lock);
+}
+
+static void
+cond_wait_thread (void *aux UNUSED) 
+{
+  lock_acquire (&lock);
+  msg ("Thread %s waiting.", thread_name ());
+  cond_wait (&condition, &lock);
+  msg ("Thread %s woke up.", thread_name ());
+  lock_release (&lock);
+}
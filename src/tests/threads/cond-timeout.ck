@@ -0,0 +1,23 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(cond-timeout) begin
+(cond-timeout) Thread timeout 1 waiting 10 ticks.
+(cond-timeout) Thread waiter waiting.
+(cond-timeout) Signaling...
+(cond-timeout) Thread timeout 1 timed out.
+(cond-timeout) Thread waiter woke up.
+(cond-timeout) 0 waiters left.
+(cond-timeout) Thread timeout 2 waiting 10 ticks.
+(cond-timeout) Signaling...
+(cond-timeout) Thread timeout 2 woke up.
+(cond-timeout) 0 waiters left.
+(cond-timeout) Thread timeout 3 waiting 1000 ticks.
+(cond-timeout) Signaling...
+(cond-timeout) Thread timeout 3 woke up.
+(cond-timeout) 0 waiters left.
+(cond-timeout) end
+EOF
+pass;
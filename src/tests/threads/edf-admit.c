@@ -0,0 +1,52 @@
+/* Tests admission control for periodic threads.
+   thread_create_periodic() must refuse a thread that would
+   commit more than 90% of the CPU to periodic threads, and must
+   give a thread's share back when it exits. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func edf_admit_thread;
+static struct semaphore go;
+
+static void admit (const char *name, int64_t period, int64_t budget);
+
+void
+test_edf_admit (void) 
+{
+  sema_init (&go, 0);
+
+  admit ("50%", 10, 5);
+  admit ("40%", 10, 4);
+  admit ("1%", 100, 1);
+
+  msg ("Letting threads exit.");
+  sema_up (&go);
+  sema_up (&go);
+
+  admit ("1%", 100, 1);
+  sema_up (&go);
+}
+
+/* Tries to create a periodic thread NAME running BUDGET ticks
+   every PERIOD ticks, and reports whether it was admitted. */
+static void
+admit (const char *name, int64_t period, int64_t budget) 
+{
+  if (thread_create_periodic (name, period, budget, edf_admit_thread, NULL)
+      != TID_ERROR)
+    msg ("Thread %s admitted.", name);
+  else
+    msg ("Thread %s rejected.", name);
+}
+
+static void
+edf_admit_thread (void *aux UNUSED) 
+{
+  msg ("Thread %s started.", thread_name ());
+  sema_down (&go);
+}
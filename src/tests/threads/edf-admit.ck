@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(edf-admit) begin
+(edf-admit) Thread 50% started.
+(edf-admit) Thread 50% admitted.
+(edf-admit) Thread 40% started.
+(edf-admit) Thread 40% admitted.
+(edf-admit) Thread 1% rejected.
+(edf-admit) Letting threads exit.
+(edf-admit) Thread 1% started.
+(edf-admit) Thread 1% admitted.
+(edf-admit) end
+EOF
+pass;
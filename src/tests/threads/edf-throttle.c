@@ -0,0 +1,64 @@
+/* Tests budget enforcement for periodic threads.  A periodic
+   thread that runs 2 ticks every 20 ticks starts a job that needs
+   about 10 ticks of CPU.  It must be throttled once its budget is
+   spent and only resume when its next period begins, so the job
+   takes several periods, and each period it overran counts as a
+   missed deadline. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+#define PERIOD 20
+#define BUDGET 2
+#define JOB_TICKS 10
+
+static thread_func edf_throttle_thread;
+static struct semaphore done;
+static int64_t job_ticks;
+
+void
+test_edf_throttle (void) 
+{
+  long long misses = thread_get_edf_misses ();
+
+  sema_init (&done, 0);
+  msg ("Starting periodic thread.");
+  if (thread_create_periodic ("periodic", PERIOD, BUDGET,
+                              edf_throttle_thread, NULL) == TID_ERROR)
+    fail ("periodic thread not admitted");
+  sema_down (&done);
+
+  if (job_ticks < 3 * PERIOD)
+    fail ("job finished after only %"PRId64" ticks", job_ticks);
+  msg ("Job took at least %d ticks.", 3 * PERIOD);
+
+  if (thread_get_edf_misses () < misses + 3)
+    fail ("only %lld deadline misses counted",
+          thread_get_edf_misses () - misses);
+  msg ("At least 3 deadline misses counted.");
+}
+
+static void
+edf_throttle_thread (void *aux UNUSED) 
+{
+  int64_t start = timer_ticks ();
+  int64_t last = start;
+  int seen = 0;
+
+  /* Busy-wait until we have seen the timer tick JOB_TICKS times
+     while running. */
+  while (seen < JOB_TICKS)
+    if (timer_ticks () != last)
+      {
+        last = timer_ticks ();
+        seen++;
+      }
+  job_ticks = timer_elapsed (start);
+  thread_wait_period ();
+  sema_up (&done);
+}
@@ -0,0 +1,12 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(edf-throttle) begin
+(edf-throttle) Starting periodic thread.
+(edf-throttle) Job took at least 60 ticks.
+(edf-throttle) At least 3 deadline misses counted.
+(edf-throttle) end
+EOF
+pass;
@@ -0,0 +1,53 @@
+/* Tests lock_acquire_timeout().  A thread that waits on a lock
+   held past its timeout must give up, return false and leave no
+   waiter behind.  A thread whose lock is released before the
+   deadline must get it.  Either way, the holder must drop back to
+   its own priority once the donation it received is gone. */
+
+#include <stdio.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func lock_timeout_thread;
+static struct lock lock;
+
+void
+test_lock_timeout (void) 
+{
+  static int64_t short_wait = 10;
+  static int64_t long_wait = 1000;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  lock_init (&lock);
+  lock_acquire (&lock);
+
+  thread_create ("short", PRI_DEFAULT + 1, lock_timeout_thread, &short_wait);
+  msg ("Main thread sleeping with the lock held.");
+  timer_sleep (50);
+  msg ("%zu waiters left.", list_size (&lock.semaphore.waiters));
+  msg ("Main thread has priority %d.", thread_get_priority ());
+
+  thread_create ("long", PRI_DEFAULT + 2, lock_timeout_thread, &long_wait);
+  msg ("Main thread releasing the lock.");
+  lock_release (&lock);
+  msg ("Main thread has priority %d.", thread_get_priority ());
+}
+
+static void
+lock_timeout_thread (void *ticks_) 
+{
+  int64_t *ticks = ticks_;
+
+  if (lock_acquire_timeout (&lock, *ticks))
+    {
+      msg ("Thread %s got the lock.", thread_name ());
+      lock_release (&lock);
+    }
+  else
+    msg ("Thread %s timed out.", thread_name ());
+}
@@ -0,0 +1,16 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(lock-timeout) begin
+(lock-timeout) Main thread sleeping with the lock held.
+(lock-timeout) Thread short timed out.
+(lock-timeout) 0 waiters left.
+(lock-timeout) Main thread has priority 31.
+(lock-timeout) Main thread releasing the lock.
+(lock-timeout) Thread long got the lock.
+(lock-timeout) Main thread has priority 31.
+(lock-timeout) end
+EOF
+pass;
@@ -0,0 +1,56 @@
+/* Tests sema_down_timeout().  A down that nobody ups must give up
+   after its timeout, return false and leave no waiter behind, so
+   that a later sema_up() raises the value instead of waking a
+   thread that has already gone.  An up that comes before the
+   deadline must win. */
+
+#include <stdio.h>
+#include <inttypes.h>
+#include "tests/threads/tests.h"
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+
+static thread_func sema_timeout_thread;
+static struct semaphore sema;
+
+void
+test_sema_timeout (void) 
+{
+  int64_t start;
+  bool success;
+
+  /* This test does not work with the MLFQS. */
+  ASSERT (!thread_mlfqs);
+
+  sema_init (&sema, 0);
+
+  success = sema_down_timeout (&sema, 0);
+  msg ("Down with no timeout %s.", success ? "succeeded" : "failed");
+
+  start = timer_ticks ();
+  success = sema_down_timeout (&sema, 10);
+  msg ("Down with 10-tick timeout %s.", success ? "succeeded" : "timed out");
+  if (timer_elapsed (start) < 10)
+    fail ("gave up after only %"PRId64" ticks", timer_elapsed (start));
+  msg ("%zu waiters left.", list_size (&sema.waiters));
+
+  sema_up (&sema);
+  msg ("Value after up is %u.", sema.value);
+  success = sema_down_timeout (&sema, 10);
+  msg ("Down with value 1 %s.", success ? "succeeded" : "timed out");
+
+  thread_create ("upper", PRI_DEFAULT - 1, sema_timeout_thread, NULL);
+  success = sema_down_timeout (&sema, 1000);
+  msg ("Down with 1000-tick timeout %s.",
+       success ? "succeeded" : "timed out");
+  msg ("%zu waiters left.", list_size (&sema.waiters));
+}
+
+static void
+sema_timeout_thread (void *aux UNUSED) 
+{
+  msg ("Thread %s upping.", thread_name ());
+  sema_up (&sema);
+}
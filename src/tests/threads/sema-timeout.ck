@@ -0,0 +1,17 @@
+# -*- perl -*-
+use strict;
+use warnings;
+use tests::tests;
+check_expected ([<<'EOF']);
+(sema-timeout) begin
+(sema-timeout) Down with no timeout failed.
+(sema-timeout) Down with 10-tick timeout timed out.
+(sema-timeout) 0 waiters left.
+(sema-timeout) Value after up is 1.
+(sema-timeout) Down with value 1 succeeded.
+(sema-timeout) Thread upper upping.
+(sema-timeout) Down with 1000-tick timeout succeeded.
+(sema-timeout) 0 waiters left.
+(sema-timeout) end
+EOF
+pass;
@@ -29,6 +29,9 @@ static const struct test tests[] =
     {"priority-preempt", test_priority_preempt},
     {"priority-sema", test_priority_sema},
     {"priority-condvar", test_priority_condvar},
+    {"sema-timeout", test_sema_timeout},
+    {"lock-timeout", test_lock_timeout},
+    {"cond-timeout", test_cond_timeout},
     {"mlfqs-load-1", test_mlfqs_load_1},
     {"mlfqs-load-60", test_mlfqs_load_60},
     {"mlfqs-load-avg", test_mlfqs_load_avg},
@@ -38,6 +41,10 @@ static const struct test tests[] =
     {"mlfqs-nice-2", test_mlfqs_nice_2},
     {"mlfqs-nice-10", test_mlfqs_nice_10},
     {"mlfqs-block", test_mlfqs_block},
+    {"stride-fair-2", test_stride_fair_2},
+    {"stride-ratio", test_stride_ratio},
+    {"edf-admit", test_edf_admit},
+    {"edf-throttle", test_edf_throttle},
     {"print-name", test_print_name},
   };
 
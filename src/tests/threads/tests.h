@@ -23,6 +23,9 @@ extern test_func test_priority_fifo;
 extern test_func test_priority_preempt;
 extern test_func test_priority_sema;
 extern test_func test_priority_condvar;
+extern test_func test_sema_timeout;
+extern test_func test_lock_timeout;
+extern test_func test_cond_timeout;
 extern test_func test_mlfqs_load_1;
 extern test_func test_mlfqs_load_60;
 extern test_func test_mlfqs_load_avg;
@@ -32,6 +35,10 @@ extern test_func test_mlfqs_fair_20;
 extern test_func test_mlfqs_nice_2;
 extern test_func test_mlfqs_nice_10;
 extern test_func test_mlfqs_block;
+extern test_func test_stride_fair_2;
+extern test_func test_stride_ratio;
+extern test_func test_edf_admit;
+extern test_func test_edf_throttle;
 extern test_func test_print_name;
 
 void msg (const char *, ...);
@@ -22,6 +22,7 @@
 #include "threads/palloc.h"
 #include "threads/pte.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -46,6 +47,12 @@
 /* Page directory with kernel mappings only. */
 uint32_t *init_page_dir;
 
+/* True if 4 MB pages are enabled (CR4.PSE). */
+bool pse_enabled;
+
+#define CPUID_PSE 0x00000008    /* CPUID 1 EDX: 4 MB pages supported. */
+#define CR4_PSE   0x00000010    /* Page Size Extensions. */
+
 #ifdef FILESYS
 /* -f: Format the file system? */
 static bool format_filesys;
@@ -63,10 +70,12 @@ static const char *swap_bdev_name;
 static size_t user_page_limit = SIZE_MAX;
 
 static void bss_init (void);
+static bool cpu_has_pse (void);
 static void paging_init (void);
 
 static char **read_command_line (void);
 static char **parse_options (char **argv);
+static void parse_calibration (char *value);
 static void run_actions (char **argv);
 static void usage (void);
 
@@ -122,6 +131,7 @@ main (void)
 
   /* Start thread scheduler and enable interrupts. */
   thread_start ();
+  workqueue_init ();
   serial_init_queue ();
   timer_calibrate ();
 
@@ -161,34 +171,69 @@ bss_init (void)
   memset (&_start_bss, 0, &_end_bss - &_start_bss);
 }
 
-/* Populates the base page directory and page table with the
+/* Returns true if the CPU supports 4 MB pages, per CPUID. */
+static bool
+cpu_has_pse (void)
+{
+  uint32_t eax = 1, ebx, ecx, edx;
+
+  asm ("cpuid" : "+a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx));
+  return (edx & CPUID_PSE) != 0;
+}
+
+/* Populates the base page directory and page tables with the
    kernel virtual mapping, and then sets up the CPU to use the
    new page directory.  Points init_page_dir to the page
-   directory it creates. */
+   directory it creates.
+
+   If the CPU supports it, each 4 MB of RAM is mapped with a
+   single 4 MB page, which saves a page table and takes one TLB
+   entry instead of 1,024.  A 4 MB region that is only partly
+   RAM, or that contains kernel text, which must be mapped
+   read-only, gets a page table of 4 kB pages as usual. */
 static void
 paging_init (void)
 {
   uint32_t *pd, *pt;
-  size_t page;
+  uintptr_t region;
   extern char _start, _end_kernel_text;
 
+  pse_enabled = cpu_has_pse ();
+
   pd = init_page_dir = palloc_get_page (PAL_ASSERT | PAL_ZERO);
-  pt = NULL;
-  for (page = 0; page < init_ram_pages; page++)
+  for (region = 0; region < init_ram_pages * PGSIZE; region += PTSPAN)
     {
-      uintptr_t paddr = page * PGSIZE;
-      char *vaddr = ptov (paddr);
-      size_t pde_idx = pd_no (vaddr);
-      size_t pte_idx = pt_no (vaddr);
-      bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
+      char *vregion = ptov (region);
+      size_t pde_idx = pd_no (vregion);
+      size_t page;
 
-      if (pd[pde_idx] == 0)
+      if (pse_enabled
+          && region + PTSPAN <= init_ram_pages * PGSIZE
+          && (vregion + PTSPAN <= &_start || vregion >= &_end_kernel_text))
         {
-          pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
-          pd[pde_idx] = pde_create (pt);
+          pd[pde_idx] = pde_create_large_kernel (vregion, true);
+          continue;
         }
 
-      pt[pte_idx] = pte_create_kernel (vaddr, !in_kernel_text);
+      pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+      pd[pde_idx] = pde_create (pt);
+      for (page = 0; page < PTSPAN / PGSIZE; page++)
+        {
+          char *vaddr = vregion + page * PGSIZE;
+          bool in_kernel_text = &_start <= vaddr && vaddr < &_end_kernel_text;
+
+          if (vtop (vaddr) >= init_ram_pages * PGSIZE)
+            break;
+          pt[pt_no (vaddr)] = pte_create_kernel (vaddr, !in_kernel_text);
+        }
+    }
+
+  /* Allow 4 MB pages.  See [IA32-v3a] 3.6.1 "Paging Options". */
+  if (pse_enabled)
+    {
+      uint32_t cr4;
+      asm volatile ("movl %%cr4, %0" : "=r" (cr4));
+      asm volatile ("movl %0, %%cr4" : : "r" (cr4 | CR4_PSE));
     }
 
   /* Store the physical address of the page directory into CR3
@@ -261,12 +306,20 @@ parse_options (char **argv)
 #ifdef VM
       else if (!strcmp (name, "-swap"))
         swap_bdev_name = value;
+      else if (!strcmp (name, "-hugepages"))
+        page_huge_enabled = true;
 #endif
 #endif
       else if (!strcmp (name, "-rs"))
         random_init (atoi (value));
       else if (!strcmp (name, "-mlfqs"))
         thread_mlfqs = true;
+      else if (!strcmp (name, "-stride"))
+        thread_stride = true;
+      else if (!strcmp (name, "-lockstat"))
+        lockstat_report = true;
+      else if (!strcmp (name, "-calib"))
+        parse_calibration (value);
 #ifdef USERPROG
       else if (!strcmp (name, "-ul"))
         user_page_limit = atoi (value);
@@ -275,6 +328,9 @@ parse_options (char **argv)
         PANIC ("unknown option `%s' (use -h for help)", name);
     }
 
+  if (thread_mlfqs && thread_stride)
+    PANIC ("-mlfqs and -stride cannot be used together");
+
   /* Initialize the random number generator based on the system
      time.  This has no effect if an "-rs" option was specified.
 
@@ -288,6 +344,22 @@ parse_options (char **argv)
   return argv;
 }
 
+/* Parses the "-calib" option's VALUE, of the form KHZ,LOOPS, as
+   printed by timer_calibrate(). */
+static void
+parse_calibration (char *value)
+{
+  char *save_ptr;
+  char *khz, *loops;
+
+  if (value == NULL
+      || (khz = strtok_r (value, ",", &save_ptr)) == NULL
+      || (loops = strtok_r (NULL, "", &save_ptr)) == NULL
+      || atoi (khz) <= 0 || atoi (loops) <= 0)
+    PANIC ("-calib requires KHZ,LOOPS (use -h for help)");
+  timer_set_calibration (atoi (khz), atoi (loops));
+}
+
 /* Runs the task specified in ARGV[1]. */
 static void
 run_task (char **argv)
@@ -386,10 +458,15 @@ usage (void)
           "  -scratch=BDEV      Use BDEV for scratch instead of default.\n"
 #ifdef VM
           "  -swap=BDEV         Use BDEV for swap instead of default.\n"
+          "  -hugepages         Map large anonymous user regions with 4 MB pages.\n"
 #endif
 #endif
           "  -rs=SEED           Set random number seed to SEED.\n"
           "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+          "  -stride            Use stride (proportional-share) scheduler.\n"
+          "  -lockstat          Print lock contention statistics at shutdown.\n"
+          "  -calib=KHZ,LOOPS   Skip timer calibration: TSC runs at KHZ kHz\n"
+          "                     and a timer tick is LOOPS delay loops.\n"
 #ifdef USERPROG
           "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
@@ -47,6 +47,29 @@ static unsigned int unexpected_cnt[INTR_CNT];
 static bool in_external_intr;   /* Are we processing an external interrupt? */
 static bool yield_on_return;    /* Should we yield on interrupt return? */
 
+/* Softirqs are the deferred halves of external interrupt
+   handlers.  A handler raises a softirq to request that its
+   softirq function run when the outermost external interrupt
+   returns, with interrupts turned back on.  Softirq functions
+   thus run in interrupt context (they may not sleep, and
+   intr_yield_on_return() requests a yield as usual), but may be
+   interrupted by external interrupts.  Interrupts stay off only
+   for as long as the handlers themselves take. */
+struct softirq_action
+  {
+    softirq_func *func;         /* Function to run. */
+    const char *name;           /* Name, for debugging purposes. */
+  };
+static struct softirq_action softirqs[SOFTIRQ_CNT];
+static unsigned softirq_pending;  /* Bitmap of raised softirqs. */
+static bool in_softirq;           /* Are we running softirqs? */
+
+/* Softirqs raised again while running are retried up to this
+   many times before being left for the next interrupt. */
+#define SOFTIRQ_MAX_ROUNDS 8
+
+static void softirq_run (void);
+
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
 static void pic_end_of_interrupt (int irq);
@@ -88,7 +111,7 @@ enum intr_level
 intr_enable (void) 
 {
   enum intr_level old_level = intr_get_level ();
-  ASSERT (!intr_context ());
+  ASSERT (!in_external_intr);
 
   /* Enable interrupts by setting the interrupt flag.
 
@@ -216,12 +239,63 @@ intr_syscall_context (void)
 }
 #endif
 
-/* Returns true during processing of an external interrupt
-   and false at all other times. */
+/* Returns true during processing of an external interrupt,
+   including its softirqs, and false at all other times. */
 bool
 intr_context (void) 
 {
-  return in_external_intr;
+  return in_external_intr || in_softirq;
+}
+
+/* Registers FUNC to run, under the given NAME, whenever
+   softirq NR has been raised. */
+void
+softirq_register (enum softirq nr, softirq_func *func, const char *name)
+{
+  ASSERT (nr < SOFTIRQ_CNT);
+  ASSERT (softirqs[nr].func == NULL);
+
+  softirqs[nr].func = func;
+  softirqs[nr].name = name;
+}
+
+/* Requests that softirq NR run when the current external
+   interrupt returns.  Must be called with interrupts off,
+   usually from an external interrupt handler. */
+void
+softirq_raise (enum softirq nr)
+{
+  ASSERT (nr < SOFTIRQ_CNT);
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  softirq_pending |= 1u << nr;
+}
+
+/* Runs pending softirqs with interrupts on.  Called with
+   interrupts off on the way out of an external interrupt that
+   did not itself interrupt softirqs. */
+static void
+softirq_run (void)
+{
+  int round;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!in_softirq);
+
+  in_softirq = true;
+  for (round = 0; round < SOFTIRQ_MAX_ROUNDS && softirq_pending != 0; round++)
+    {
+      unsigned pending = softirq_pending;
+      enum softirq nr;
+
+      softirq_pending = 0;
+      asm volatile ("sti" : : : "memory");
+      for (nr = 0; nr < SOFTIRQ_CNT; nr++)
+        if (pending & (1u << nr))
+          softirqs[nr].func ();
+      asm volatile ("cli" : : : "memory");
+    }
+  in_softirq = false;
 }
 
 /* During processing of an external interrupt, directs the
@@ -360,15 +434,18 @@ intr_handler (struct intr_frame *frame)
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
      and they need to be acknowledged on the PIC (see below).
-     An external interrupt handler cannot sleep. */
+     An external interrupt handler cannot sleep.  External
+     interrupts can arrive while softirqs run, in which case a
+     yield they request waits until the softirqs finish. */
   external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
-      ASSERT (!intr_context ());
+      ASSERT (!in_external_intr);
 
       in_external_intr = true;
-      yield_on_return = false;
+      if (!in_softirq)
+        yield_on_return = false;
     }
 #ifdef USERPROG
 	else if (frame->vec_no == 0x30)
@@ -399,8 +476,16 @@ intr_handler (struct intr_frame *frame)
       in_external_intr = false;
       pic_end_of_interrupt (frame->vec_no); 
 
-      if (yield_on_return) 
-        thread_yield (); 
+      /* Run the deferred halves of interrupt handlers, unless
+         this interrupt arrived while they were already running,
+         in which case the interrupted run picks up its work. */
+      if (!in_softirq)
+        {
+          if (softirq_pending != 0)
+            softirq_run ();
+          if (yield_on_return) 
+            thread_yield (); 
+        }
     }
 #ifdef USERPROG
 	else if (frame->vec_no == 0x30)
@@ -65,6 +65,19 @@ bool intr_context (void);
 bool intr_syscall_context (void);
 void intr_yield_on_return (void);
 
+/* Deferred halves of external interrupt handlers. */
+enum softirq
+  {
+    SOFTIRQ_TIMER,              /* Timer tick bookkeeping. */
+    SOFTIRQ_BLOCK,              /* Block device completions. */
+    SOFTIRQ_CNT                 /* Number of softirqs. */
+  };
+
+typedef void softirq_func (void);
+
+void softirq_register (enum softirq, softirq_func *, const char *name);
+void softirq_raise (enum softirq);
+
 void intr_dump_frame (const struct intr_frame *);
 const char *intr_name (uint8_t vec);
 
@@ -27,13 +27,44 @@
 */
 
 #include "threads/synch.h"
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#include "devices/timer.h"
+#ifdef LOCKSTAT
+#include "threads/tsc.h"
+#endif
 
 extern int thread_priority;     
 
+/* Deadline for waits that never time out. */
+#define WAIT_FOREVER INT64_MAX
+
+static bool sema_down_until (struct semaphore *, int64_t deadline);
+static bool lock_acquire_until (struct lock *, int64_t deadline);
+static void lock_redonate (struct lock *);
+
+/* If true, print lock statistics at shutdown.
+   Controlled by kernel command-line option "-lockstat". */
+bool lockstat_report;
+
+#ifdef LOCKSTAT
+/* Statistics for every distinct lock name seen by lock_init().
+   Locks are grouped by name rather than tracked one by one, so
+   that locks living on a stack or in freed memory never leave
+   dangling entries behind. */
+#define LOCKSTAT_MAX 64
+static struct lock_stat lock_stats[LOCKSTAT_MAX];
+static size_t lock_stat_cnt;
+
+static struct lock_stat *lockstat_lookup (const char *name);
+static void lockstat_acquired (struct lock_stat *, uint64_t *acquired_tsc,
+                               bool contended, int64_t wait_start);
+static void lockstat_released (struct lock_stat *, uint64_t acquired_tsc);
+#endif
+
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
    manipulating it:
@@ -77,6 +108,58 @@ sema_down (struct semaphore *sema)
   intr_set_level (old_level);
 }
 
+/* Same as sema_down(), but gives up after waiting TICKS timer
+   ticks.  Returns true if SEMA was decremented, false if the wait
+   timed out.  If TICKS is not positive, does not wait at all.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+bool
+sema_down_timeout (struct semaphore *sema, int64_t ticks)
+{
+  ASSERT (sema != NULL);
+  ASSERT (!intr_context ());
+
+  if (ticks <= 0)
+    return sema_try_down (sema);
+  return sema_down_until (sema, timer_ticks () + ticks);
+}
+
+/* Down operation on SEMA that gives up at timer tick DEADLINE,
+   or never if DEADLINE is WAIT_FOREVER.  Returns true if SEMA was
+   decremented.  The thread waits on SEMA's waiters and, through
+   timer_block(), on the timer at the same time, and is woken by
+   whichever comes first. */
+static bool
+sema_down_until (struct semaphore *sema, int64_t deadline)
+{
+  enum intr_level old_level;
+  bool success = true;
+
+  if (deadline == WAIT_FOREVER)
+    {
+      sema_down (sema);
+      return true;
+    }
+
+  old_level = intr_disable ();
+  while (sema->value == 0)
+    {
+      if (timer_ticks () >= deadline)
+        {
+          success = false;
+          break;
+        }
+      list_push_back (&sema->waiters, &thread_current ()->elem);
+      timer_block (deadline);
+    }
+  if (success)
+    sema->value--;
+  intr_set_level (old_level);
+
+  return success;
+}
+
 /* Down or "P" operation on a semaphore, but only if the
    semaphore is not already 0.  Returns true if the semaphore is
    decremented, false otherwise.
@@ -184,15 +267,23 @@ sema_test_helper (void *sema_)
    another one "up" it, but with a lock the same thread must both
    acquire and release it.  When these restrictions prove
    onerous, it's a good sign that a semaphore should be used,
-   instead of a lock. */
+   instead of a lock.
+
+   NAME identifies the lock in the statistics printed by
+   lockstat_print().  Usually this is called through the
+   lock_init() macro, which names the lock after its argument. */
 void
-lock_init (struct lock *lock)
+lock_init_named (struct lock *lock, const char *name UNUSED)
 {
   ASSERT (lock != NULL);
 
   lock->holder = NULL;
 	lock->boosted_priority = -1;
   sema_init (&lock->semaphore, 1);
+#ifdef LOCKSTAT
+  lock->stat = lockstat_lookup (name);
+  lock->acquired_tsc = 0;
+#endif
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
@@ -205,21 +296,54 @@ lock_init (struct lock *lock)
    we need to sleep. */
 void
 lock_acquire (struct lock *lock)
+{
+  lock_acquire_until (lock, WAIT_FOREVER);
+}
+
+/* Same as lock_acquire(), but gives up after waiting TICKS timer
+   ticks.  Returns true if LOCK was acquired, false if the wait
+   timed out.
+
+   A priority donated to the holder while waiting is taken back
+   on timeout, so that the holder drops to the highest priority
+   of the threads still waiting. */
+bool
+lock_acquire_timeout (struct lock *lock, int64_t ticks)
+{
+  return lock_acquire_until (lock, timer_ticks () + (ticks > 0 ? ticks : 0));
+}
+
+/* Acquires LOCK, giving up at timer tick DEADLINE, or never if
+   DEADLINE is WAIT_FOREVER.  Returns true if LOCK was acquired. */
+static bool
+lock_acquire_until (struct lock *lock, int64_t deadline)
 {
 	enum intr_level old_level;
 	struct thread *t;
 	struct thread *cur = thread_current ();
+	bool acquired = true;
 
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+#ifdef LOCKSTAT
+	bool contended = lock->semaphore.value == 0;
+	int64_t wait_start = contended ? timer_ticks () : 0;
+#endif
+
 #ifdef VM
 	old_level = intr_disable ();
-	sema_down (&lock->semaphore);
+	if (!sema_down_until (&lock->semaphore, deadline)) {
+		intr_set_level (old_level);
+		return false;
+	}
   lock->holder = cur;
+#ifdef LOCKSTAT
+	lockstat_acquired (lock->stat, &lock->acquired_tsc, contended, wait_start);
+#endif
 	intr_set_level (old_level);
-	return;
+	return true;
 #endif
 
 	old_level = intr_disable ();
@@ -244,18 +368,71 @@ lock_acquire (struct lock *lock)
 			intr_set_level (old_level);
 
 			/* Lock acquire */
-			sema_down (&lock->semaphore);
+			acquired = sema_down_until (&lock->semaphore, deadline);
 			cur->donated_for = NULL;
 			cur->donated_to_get = NULL;
+			if (!acquired) {
+				old_level = intr_disable ();
+				lock_redonate (lock);
+				intr_set_level (old_level);
+			}
 		} else {
 			intr_set_level (old_level);
-			sema_down (&lock->semaphore);
+			acquired = sema_down_until (&lock->semaphore, deadline);
 		}
 	} else {
 		intr_set_level (old_level);
 	}
+	if (!acquired)
+		return false;
 	list_push_back (&cur->hold_list, &lock->holdelem);
   lock->holder = cur;
+#ifdef LOCKSTAT
+	lockstat_acquired (lock->stat, &lock->acquired_tsc, contended, wait_start);
+#endif
+	return true;
+}
+
+/* Recomputes the priority donated through LOCK from the threads
+   still waiting for it, after one that donated has given up, and
+   the effective priority of its holder from that.  Follows the
+   holder's own donation, if any, down the chain of nested locks.
+   Interrupts must be off. */
+static void
+lock_redonate (struct lock *lock)
+{
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	while (lock != NULL && lock->holder != NULL) {
+		struct thread *holder = lock->holder;
+		struct list_elem *e;
+		int max;
+
+		/* Donation still owed through LOCK. */
+		lock->boosted_priority = -1;
+		for (e = list_begin (&lock->semaphore.waiters);
+				 e != list_end (&lock->semaphore.waiters); e = list_next (e)) {
+			struct thread *w = list_entry (e, struct thread, elem);
+			if (w->priority > holder->original_priority
+					&& w->priority > lock->boosted_priority)
+				lock->boosted_priority = w->priority;
+		}
+
+		/* Holder's effective priority, as in lock_release(). */
+		max = holder->original_priority;
+		for (e = list_begin (&holder->hold_list);
+				 e != list_end (&holder->hold_list); e = list_next (e)) {
+			struct lock *l = list_entry (e, struct lock, holdelem);
+			if (max < l->boosted_priority)
+				max = l->boosted_priority;
+		}
+		if (max == holder->priority)
+			break;
+		holder->priority = max;
+		thread_requeue (holder);
+
+		lock = holder->donated_for != NULL ? holder->donated_to_get : NULL;
+	}
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -295,6 +472,10 @@ lock_release (struct lock *lock)
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+#ifdef LOCKSTAT
+	lockstat_released (lock->stat, lock->acquired_tsc);
+#endif
+
 #ifdef VM
 	old_level = intr_disable ();
   lock->holder = NULL;
@@ -389,19 +570,54 @@ cond_wait (struct condition *cond, struct lock *lock)
   lock_acquire (lock);
 }
 
-/* Check if thread of sema a's priority higher than b's. */
+/* Same as cond_wait(), but stops waiting for COND after TICKS
+   timer ticks.  LOCK is reacquired before returning either way.
+   Returns true if COND was signaled, false if the wait timed
+   out. */
+bool
+cond_wait_timeout (struct condition *cond, struct lock *lock, int64_t ticks)
+{
+  struct semaphore_elem waiter;
+  bool signaled;
+
+  ASSERT (cond != NULL);
+  ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
+  
+  sema_init (&waiter.semaphore, 0);
+  list_push_back (&cond->waiters, &waiter.elem);
+  lock_release (lock);
+  signaled = sema_down_timeout (&waiter.semaphore, ticks);
+  lock_acquire (lock);
+
+  /* A signal may have come after the timeout but before we got
+     LOCK back.  If not, we are still on COND's list. */
+  if (!signaled)
+    {
+      signaled = sema_try_down (&waiter.semaphore);
+      if (!signaled)
+        list_remove (&waiter.elem);
+    }
+  return signaled;
+}
+
+/* Check if thread of sema a's priority higher than b's.
+	 A waiter that is not blocked on its semaphore, because it has
+	 not got there yet or has timed out, sorts last. */
 bool
 sema_higher (const struct list_elem *a,
                              const struct list_elem *b,
                              void *aux UNUSED){
-	struct list_elem *aa = list_entry (a, struct semaphore_elem, elem)->semaphore.waiters.head.next;
-	struct list_elem *bb = list_entry (b, struct semaphore_elem, elem)->semaphore.waiters.head.next;
-
-	ASSERT (aa != NULL);
-	ASSERT (bb != NULL);
-
-	return list_entry (aa, struct thread, elem)->priority
-						> list_entry (bb, struct thread, elem)->priority;
+	struct list *aw = &list_entry (a, struct semaphore_elem, elem)->semaphore.waiters;
+	struct list *bw = &list_entry (b, struct semaphore_elem, elem)->semaphore.waiters;
+
+	if (list_empty (aw))
+		return false;
+	if (list_empty (bw))
+		return true;
+	return list_entry (list_front (aw), struct thread, elem)->priority
+						> list_entry (list_front (bw), struct thread, elem)->priority;
 }
 
 
@@ -442,3 +658,325 @@ cond_broadcast (struct condition *cond, struct lock *lock)
   while (!list_empty (&cond->waiters))
     cond_signal (cond, lock);
 }
+
+static void rwlock_grant_readers (struct rwlock *);
+static void rwlock_grant_writer (struct rwlock *);
+
+/* Initializes RW.  A reader-writer lock may be held by any
+   number of readers at once, or by a single writer.
+
+   Writers are preferred: once a writer is waiting, newly
+   arriving readers queue up behind it, so a stream of readers
+   cannot starve writers.  When a writer releases the lock, all
+   readers that queued up meanwhile are let in together as one
+   batch, unless the highest-priority waiting writer outranks
+   every one of them.  Ownership is handed directly to the
+   threads being woken up, so they never need to recheck.
+
+   NAME is used as for lock_init_named(). */
+void
+rwlock_init_named (struct rwlock *rw, const char *name UNUSED)
+{
+  ASSERT (rw != NULL);
+
+  rw->readers = 0;
+  rw->writer = NULL;
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+#ifdef LOCKSTAT
+  rw->stat = lockstat_lookup (name);
+  rw->acquired_tsc = 0;
+#endif
+}
+
+/* Acquires RW for reading, sleeping until no writer holds or is
+   waiting for it.  Must not be called by the thread holding RW
+   for writing.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && list_empty (&rw->write_waiters))
+    {
+      rw->readers++;
+#ifdef LOCKSTAT
+      lockstat_acquired (rw->stat, NULL, false, 0);
+#endif
+    }
+  else
+    {
+#ifdef LOCKSTAT
+      int64_t wait_start = timer_ticks ();
+#endif
+      /* rwlock_grant_readers() counts us in before waking us. */
+      list_push_back (&rw->read_waiters, &thread_current ()->elem);
+      thread_block ();
+#ifdef LOCKSTAT
+      lockstat_acquired (rw->stat, NULL, true, wait_start);
+#endif
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases read access to RW.  The last reader out hands the
+   lock to the highest-priority waiting writer, if any. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+
+  old_level = intr_disable ();
+  ASSERT (rw->readers > 0);
+  if (--rw->readers == 0 && !list_empty (&rw->write_waiters))
+    rwlock_grant_writer (rw);
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping until no other thread holds
+   it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+  struct thread *cur = thread_current ();
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_by_current_thread (rw));
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && rw->readers == 0)
+    {
+      rw->writer = cur;
+#ifdef LOCKSTAT
+      lockstat_acquired (rw->stat, &rw->acquired_tsc, false, 0);
+#endif
+    }
+  else
+    {
+#ifdef LOCKSTAT
+      int64_t wait_start = timer_ticks ();
+#endif
+      /* rwlock_grant_writer() makes us the writer before waking us. */
+      list_push_back (&rw->write_waiters, &cur->elem);
+      thread_block ();
+      ASSERT (rw->writer == cur);
+#ifdef LOCKSTAT
+      lockstat_acquired (rw->stat, &rw->acquired_tsc, true, wait_start);
+#endif
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases write access to RW, which must be held by the current
+   thread. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+  struct thread *r, *w;
+
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_by_current_thread (rw));
+
+#ifdef LOCKSTAT
+  lockstat_released (rw->stat, rw->acquired_tsc);
+#endif
+
+  old_level = intr_disable ();
+  rw->writer = NULL;
+  if (!list_empty (&rw->read_waiters))
+    {
+      r = list_entry (list_min (&rw->read_waiters, thread_higher, NULL),
+                      struct thread, elem);
+      w = NULL;
+      if (!list_empty (&rw->write_waiters))
+        w = list_entry (list_min (&rw->write_waiters, thread_higher, NULL),
+                        struct thread, elem);
+      if (w == NULL || r->priority >= w->priority)
+        rwlock_grant_readers (rw);
+      else
+        rwlock_grant_writer (rw);
+    }
+  else if (!list_empty (&rw->write_waiters))
+    rwlock_grant_writer (rw);
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current thread holds RW for writing, false
+   otherwise.  Readers are not tracked individually. */
+bool
+rwlock_held_by_current_thread (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* Lets every thread waiting to read RW in as one batch, waking
+   them in priority order.  Interrupts must be off. */
+static void
+rwlock_grant_readers (struct rwlock *rw)
+{
+  struct list batch;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Take the batch off the wait list first: waking a reader may
+     yield, and readers arriving meanwhile are not part of it. */
+  list_init (&batch);
+  list_splice (list_end (&batch), list_begin (&rw->read_waiters),
+               list_end (&rw->read_waiters));
+  rw->readers += list_size (&batch);
+
+  list_sort (&batch, thread_higher, NULL);
+  while (!list_empty (&batch))
+    thread_unblock (list_entry (list_pop_front (&batch),
+                                struct thread, elem));
+}
+
+/* Hands RW to the highest-priority thread waiting to write it.
+   Interrupts must be off. */
+static void
+rwlock_grant_writer (struct rwlock *rw)
+{
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (rw->writer == NULL && rw->readers == 0);
+
+  e = list_min (&rw->write_waiters, thread_higher, NULL);
+  list_remove (e);
+  rw->writer = list_entry (e, struct thread, elem);
+  thread_unblock (rw->writer);
+}
+
+/* Prints lock contention statistics, most contended first.
+   Only hold times of exclusive owners are measured; readers of
+   a rwlock count towards acquisitions and waits only. */
+void
+lockstat_print (void)
+{
+#ifdef LOCKSTAT
+  struct lock_stat *sorted[LOCKSTAT_MAX];
+  size_t cnt, i, j;
+
+  /* Sort by contended acquisitions, then by time spent waiting. */
+  cnt = lock_stat_cnt;
+  for (i = 0; i < cnt; i++)
+    {
+      struct lock_stat *ls = &lock_stats[i];
+      for (j = i; j > 0; j--)
+        {
+          struct lock_stat *prev = sorted[j - 1];
+          if (prev->contended > ls->contended
+              || (prev->contended == ls->contended
+                  && prev->wait_ticks >= ls->wait_ticks))
+            break;
+          sorted[j] = prev;
+        }
+      sorted[j] = ls;
+    }
+
+  printf ("Locks: %-16s %10s %10s %10s %8s %16s\n", "name", "acquires",
+          "contended", "wait", "max", "hold cycles");
+  for (i = 0; i < cnt; i++)
+    if (sorted[i]->acquires > 0)
+      printf ("       %-16s %10"PRIu64" %10"PRIu64" %10"PRId64" %8"PRId64
+              " %16"PRIu64"\n",
+              sorted[i]->name, sorted[i]->acquires, sorted[i]->contended,
+              sorted[i]->wait_ticks, sorted[i]->max_wait_ticks,
+              sorted[i]->hold_cycles);
+#else
+  printf ("Locks: statistics not compiled in (build with -DLOCKSTAT).\n");
+#endif
+}
+
+#ifdef LOCKSTAT
+/* Returns the statistics slot for locks called NAME, creating it
+   if needed.  A leading `&' from the lock_init() macro is
+   dropped.  Returns a null pointer if the table is full. */
+static struct lock_stat *
+lockstat_lookup (const char *name)
+{
+  struct lock_stat *ls = NULL;
+  enum intr_level old_level;
+  size_t i;
+
+  if (name[0] == '&')
+    name++;
+
+  old_level = intr_disable ();
+  for (i = 0; i < lock_stat_cnt; i++)
+    if (!strcmp (lock_stats[i].name, name))
+      {
+        ls = &lock_stats[i];
+        break;
+      }
+  if (ls == NULL && lock_stat_cnt < LOCKSTAT_MAX)
+    {
+      ls = &lock_stats[lock_stat_cnt++];
+      ls->name = name;
+    }
+  intr_set_level (old_level);
+
+  return ls;
+}
+
+/* Accounts for one acquisition in LS.  If CONTENDED, the caller
+   had to wait since timer tick WAIT_START.  If ACQUIRED_TSC is
+   non-null, the current TSC is stored there to measure the hold
+   time. */
+static void
+lockstat_acquired (struct lock_stat *ls, uint64_t *acquired_tsc,
+                   bool contended, int64_t wait_start)
+{
+  enum intr_level old_level;
+
+  if (ls == NULL)
+    return;
+
+  old_level = intr_disable ();
+  ls->acquires++;
+  if (contended)
+    {
+      int64_t wait = timer_ticks () - wait_start;
+      ls->contended++;
+      ls->wait_ticks += wait;
+      if (wait > ls->max_wait_ticks)
+        ls->max_wait_ticks = wait;
+    }
+  if (acquired_tsc != NULL)
+    *acquired_tsc = rdtsc ();
+  intr_set_level (old_level);
+}
+
+/* Accounts for the release of a lock in LS that was acquired at
+   TSC value ACQUIRED_TSC. */
+static void
+lockstat_released (struct lock_stat *ls, uint64_t acquired_tsc)
+{
+  enum intr_level old_level;
+
+  if (ls == NULL)
+    return;
+
+  old_level = intr_disable ();
+  ls->hold_cycles += rdtsc () - acquired_tsc;
+  intr_set_level (old_level);
+}
+#endif
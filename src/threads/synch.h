@@ -3,6 +3,7 @@
 
 #include <list.h>
 #include <stdbool.h>
+#include <stdint.h>
 
 /* A counting semaphore. */
 struct semaphore 
@@ -13,10 +14,25 @@ struct semaphore
 
 void sema_init (struct semaphore *, unsigned value);
 void sema_down (struct semaphore *);
+bool sema_down_timeout (struct semaphore *, int64_t ticks);
 bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
+#ifdef LOCKSTAT
+/* Contention statistics, shared by every lock initialized with
+   the same name.  Only compiled in with -DLOCKSTAT. */
+struct lock_stat
+  {
+    const char *name;           /* Lock name. */
+    uint64_t acquires;          /* # of acquisitions. */
+    uint64_t contended;         /* # of acquisitions that had to wait. */
+    int64_t wait_ticks;         /* Total timer ticks spent waiting. */
+    int64_t max_wait_ticks;     /* Longest single wait, in timer ticks. */
+    uint64_t hold_cycles;       /* Total TSC cycles the lock was held. */
+  };
+#endif
+
 /* Lock. */
 struct lock 
   {
@@ -24,10 +40,19 @@ struct lock
     struct semaphore semaphore; /* Binary semaphore controlling access. */
 		struct list_elem holdelem;  /* List element for holded locks list for a thread. */
     int boosted_priority;       /* Boosted priority when donation occurs. */
+#ifdef LOCKSTAT
+    struct lock_stat *stat;     /* Statistics slot, or NULL. */
+    uint64_t acquired_tsc;      /* TSC when the holder acquired it. */
+#endif
   };
 
-void lock_init (struct lock *);
+/* Locks are named after the expression passed to lock_init(),
+   e.g. "frame_lock", unless lock_init_named() gives a better
+   name.  The name is only kept when LOCKSTAT is defined. */
+#define lock_init(LOCK) lock_init_named (LOCK, #LOCK)
+void lock_init_named (struct lock *, const char *name);
 void lock_acquire (struct lock *);
+bool lock_acquire_timeout (struct lock *, int64_t ticks);
 /*bool lock_try_acquire (struct lock *);*/
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
@@ -40,9 +65,35 @@ struct condition
 
 void cond_init (struct condition *);
 void cond_wait (struct condition *, struct lock *);
+bool cond_wait_timeout (struct condition *, struct lock *, int64_t ticks);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock
+  {
+    unsigned readers;           /* # of threads holding read access. */
+    struct thread *writer;      /* Thread holding write access. */
+    struct list read_waiters;   /* Threads waiting for read access. */
+    struct list write_waiters;  /* Threads waiting for write access. */
+#ifdef LOCKSTAT
+    struct lock_stat *stat;     /* Statistics slot, or NULL. */
+    uint64_t acquired_tsc;      /* TSC when the writer acquired it. */
+#endif
+  };
+
+#define rwlock_init(RW) rwlock_init_named (RW, #RW)
+void rwlock_init_named (struct rwlock *, const char *name);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_by_current_thread (const struct rwlock *);
+
+/* Lock contention report, see lockstat_print(). */
+extern bool lockstat_report;
+void lockstat_print (void);
+
 bool thread_higher (const struct list_elem *, const struct list_elem *, void *);
 bool sema_higher (const struct list_elem *, const struct list_elem *, void *);
 
@@ -2,6 +2,7 @@
 #include <debug.h>
 #include <stddef.h>
 #include <random.h>
+#include <round.h>
 #include <stdio.h>
 #include <string.h>
 #include "threads/flags.h"
@@ -11,6 +12,7 @@
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
+#include "devices/timer.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #endif
@@ -23,12 +25,40 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
+/* The run queue.
 
-/* Multi-grouped list of ready_list. Grouped by priority. */
-struct list pri_list[PRI_MAX+1];
+   Holds the threads in THREAD_READY state, that is, threads that
+   are ready to run but not actually running, grouped by priority
+   in pri_list.  When it is empty, the idle thread runs.
+
+   Under the stride scheduler, ready threads are instead kept in
+   pass_heap, a binary min-heap ordered by pass, so that picking
+   the next thread and adding one are O(log n).  The heap is an
+   array that is grown ahead of time, by thread_create(), so that
+   the scheduler never allocates memory.
+
+   Threads created by thread_create_periodic() form a real-time
+   class above all of these.  While they have budget left they are
+   kept in edf_list, ordered by deadline, and always run before
+   best-effort threads.  One that uses up its budget is parked in
+   edf_throttled until its next period begins.
+
+   Protected by turning interrupts off. */
+struct run_queue
+  {
+    struct list pri_list[PRI_MAX+1];    /* Ready threads, by priority. */
+    size_t ready_cnt;                   /* # of ready threads. */
+    struct thread *idle_thread;         /* Runs when nothing is ready. */
+    struct list edf_list;               /* Ready EDF threads, by deadline. */
+    struct list edf_throttled;          /* EDF threads out of budget. */
+
+    /* Stride scheduler only. */
+    struct thread **pass_heap;          /* Ready threads, by pass. */
+    size_t pass_heap_cap;               /* Capacity of pass_heap. */
+    uint64_t pass_floor;                /* Pass of last thread dispatched. */
+  };
+
+static struct run_queue rq;
 
 /* List of sleeping processes, that is, processes that should be 
 	 checked each tick whether it should be awake or not. */
@@ -38,16 +68,30 @@ struct list sleep_list;
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
 
+/* Index of live threads keyed by tid, so that looking up a
+   thread does not have to walk all_list.  Threads are inserted
+   by thread_create() and removed when their page is freed.
+   Protected by tid_lock. */
+static struct hash tid_table;
+
 /* List of recent_cpu changed processes. */
 struct list rcc_list;
 
-/* Idle thread. */
-static struct thread *idle_thread;
-
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
-/* Lock used by allocate_tid(). */
+/* Cache of recently freed thread pages.  Reusing these lets
+   thread_create() skip the page allocator's bitmap scan and the
+   zeroing of a whole page: init_thread() clears `struct thread'
+   itself, and only THREAD_STACK_GUARD bytes above it are cleared
+   here.  Protected by disabling interrupts, because pages are
+   freed from thread_schedule_tail(). */
+#define THREAD_CACHE_SIZE 16
+#define THREAD_STACK_GUARD 64
+static struct thread *thread_cache[THREAD_CACHE_SIZE];
+static size_t thread_cache_cnt;
+
+/* Lock used by allocate_tid() and for tid_table. */
 static struct lock tid_lock;
 
 /* Stack frame for kernel_thread(). */
@@ -64,27 +108,74 @@ static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 static fixed load_avg;          /* System load average. */
 
+/* Once a second every thread's recent_cpu decays by a factor
+   that depends on load_avg.  Only runnable threads are decayed
+   then.  A blocked thread instead catches up on the decays it
+   missed, in decay_catch_up(), when it becomes runnable again.
+   The factors of the last DECAY_HIST seconds are kept for that;
+   older ones are taken to equal the oldest kept. */
+#define DECAY_HIST 64
+static unsigned decay_epoch;    /* # of decays so far. */
+static fixed decay_hist[DECAY_HIST]; /* Factor of decay E at E % DECAY_HIST. */
+
 /* Scheduling. */
 #define TIME_SLICE 4            /* # of timer ticks to give each thread. */
 static unsigned thread_ticks;   /* # of timer ticks since last yield. */
 int thread_priority;            /* priority of current running thread. */
+static size_t thread_cnt;       /* # of threads, for sizing pass_heap. */
+
+/* Stride scheduler.  A thread with N tickets has its pass
+   advanced by STRIDE1 / N per tick it runs, and the ready thread
+   with the lowest pass runs next. */
+#define STRIDE1 (1 << 20)
+
+/* Earliest deadline first.  Periodic threads are admitted only
+   while the sum of their budget / period stays within
+   EDF_UTIL_MAX per mille, leaving the rest of the CPU for
+   best-effort threads.  Protected by disabling interrupts. */
+#define EDF_UTIL_MAX 900
+static int edf_util;            /* Admitted utilization, per mille. */
+static long long edf_jobs;      /* # of periodic jobs finished. */
+static long long edf_misses;    /* # of deadlines missed. */
 
 /* If false (default), use round-robin scheduler.
    If true, use multi-level feedback queue scheduler.
    Controlled by kernel command-line option "-o mlfqs". */
 bool thread_mlfqs;
 
+/* If true, use the stride scheduler.
+   Controlled by kernel command-line option "-stride". */
+bool thread_stride;
+
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
 static struct thread *running_thread (void);
 static struct thread *next_thread_to_run (void);
+static void rq_push (struct thread *);
+static struct thread *rq_pop (void);
+static bool thread_preempts (const struct thread *);
+static void decay_catch_up (struct thread *);
+static void decay_list (struct list *);
+static struct thread *thread_spawn (const char *name, int priority,
+                                    thread_func *, void *);
+static int edf_share (int64_t period, int64_t budget);
+static void edf_tick (struct thread *);
+static bool edf_less (const struct list_elem *, const struct list_elem *,
+                      void *aux);
+static bool pass_heap_reserve (void);
+static void pass_heap_push (struct thread *);
+static struct thread *pass_heap_pop (void);
+static struct thread *thread_page_get (void);
 static void init_thread (struct thread *, const char *name, int priority, int nice, bool is_user_thread);
 static bool is_thread (struct thread *) UNUSED;
 static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static unsigned tid_hash (const struct hash_elem *, void *aux);
+static bool tid_less (const struct hash_elem *, const struct hash_elem *,
+                      void *aux);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -107,31 +198,43 @@ thread_init (void)
   ASSERT (intr_get_level () == INTR_OFF);
 
   lock_init (&tid_lock);
-  list_init (&ready_list);
   list_init (&sleep_list);
   list_init (&all_list);
 	if(thread_mlfqs) {
 		list_init (&rcc_list);
 	}
 
+	/* Set up the run queue. */
 	for (i=PRI_MIN ; i<=PRI_MAX ; i++){
-  	list_init (&pri_list[i]);
+  	list_init (&rq.pri_list[i]);
 	}
+	rq.ready_cnt = 0;
+	list_init (&rq.edf_list);
+	list_init (&rq.edf_throttled);
 
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT, NICE_DEFAULT, false);
+  thread_cnt = 1;
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
-   Also creates the idle thread. */
+   Also creates the idle thread.
+
+   The tid index is set up here rather than in thread_init()
+   because hash_init() needs malloc(). */
 void
 thread_start (void) 
 {
-  /* Create the idle thread. */
   struct semaphore idle_started;
+
+  if (!hash_init (&tid_table, tid_hash, tid_less, NULL))
+    PANIC ("thread_start: can't allocate tid table");
+  hash_insert (&tid_table, &initial_thread->tidelem);
+
+  /* Create the idle thread. */
   sema_init (&idle_started, 0);
   thread_create ("idle", PRI_MIN, idle, &idle_started);
 
@@ -148,6 +251,7 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  struct thread *idle_thread = rq.idle_thread;
 
   /* Update statistics. */
   if (t == idle_thread)
@@ -171,6 +275,12 @@ thread_tick (void)
 		t->recent_cpu = faddn(t->recent_cpu, 1);
 	}
 
+	/* Charge the tick to the thread's pass. */
+	if (thread_stride && t != idle_thread)
+		t->pass += STRIDE1 / t->tickets;
+
+	edf_tick (t);
+
   /* Enforce preemption. */
   if (++thread_ticks >= TIME_SLICE)
     intr_yield_on_return ();
@@ -182,6 +292,8 @@ thread_print_stats (void)
 {
   printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
           idle_ticks, kernel_ticks, user_ticks);
+  if (edf_jobs > 0 || edf_misses > 0)
+    printf ("EDF: %lld jobs, %lld deadline misses\n", edf_jobs, edf_misses);
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -202,21 +314,155 @@ thread_print_stats (void)
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
+{
+  return thread_create_handle (name, priority, function, aux, NULL);
+}
+
+/* Same as thread_create(), but if HANDLE is non-null also stores
+   the new thread into *HANDLE before it is added to the ready
+   queue, so that the caller does not need get_thread_by_tid().
+
+   The handle is only safe to use as long as the new thread's
+   page is not freed.  That holds for user processes, whose TCB
+   is kept until the parent calls process_wait(), but a plain
+   kernel thread may be destroyed at any time once it runs. */
+tid_t
+thread_create_handle (const char *name, int priority,
+                      thread_func *function, void *aux,
+                      struct thread **handle)
+{
+  struct thread *t = thread_spawn (name, priority, function, aux);
+
+  if (t == NULL)
+    return TID_ERROR;
+  if (handle != NULL)
+    *handle = t;
+
+  /* Add to run queue. */
+  thread_unblock (t);
+
+  return t->tid;
+}
+
+/* Creates a periodic real-time thread named NAME, which executes
+   FUNCTION passing AUX as the argument.  The thread may run for
+   up to BUDGET timer ticks in every PERIOD ticks, starting now,
+   and is scheduled earliest deadline first ahead of all other
+   threads, the deadline being the end of each period.  FUNCTION
+   should call thread_wait_period() when it has finished the work
+   of a period.
+
+   Returns the new thread's identifier, or TID_ERROR if it could
+   not be created or if admitting it would commit more than
+   EDF_UTIL_MAX per mille of the CPU to periodic threads. */
+tid_t
+thread_create_periodic (const char *name, int64_t period, int64_t budget,
+                        thread_func *function, void *aux)
+{
+  struct thread *t;
+  enum intr_level old_level;
+  int share;
+
+  ASSERT (0 < budget && budget <= period);
+
+  /* Admission control. */
+  share = edf_share (period, budget);
+  old_level = intr_disable ();
+  if (edf_util + share > EDF_UTIL_MAX)
+    {
+      intr_set_level (old_level);
+      return TID_ERROR;
+    }
+  edf_util += share;
+  intr_set_level (old_level);
+
+  t = thread_spawn (name, PRI_DEFAULT, function, aux);
+  if (t == NULL)
+    {
+      old_level = intr_disable ();
+      edf_util -= share;
+      intr_set_level (old_level);
+      return TID_ERROR;
+    }
+
+  t->edf_period = period;
+  t->edf_budget = budget;
+  t->edf_left = budget;
+  t->edf_deadline = timer_ticks () + period;
+  thread_unblock (t);
+
+  return t->tid;
+}
+
+/* Ends the running periodic thread's work for this period and
+   sleeps until the next one begins.  If the period's deadline
+   has already passed, counts a miss and starts the next period
+   at once. */
+void
+thread_wait_period (void)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int64_t now, release;
+
+  ASSERT (cur->edf_period != 0);
+
+  old_level = intr_disable ();
+  now = timer_ticks ();
+  edf_jobs++;
+  if (now > cur->edf_deadline)
+    {
+      edf_misses++;
+      release = now;
+    }
+  else
+    release = cur->edf_deadline;
+  cur->edf_deadline = release + cur->edf_period;
+  cur->edf_left = cur->edf_budget;
+  intr_set_level (old_level);
+
+  if (release > now)
+    timer_sleep (release - now);
+}
+
+/* Returns the number of deadlines missed by periodic threads
+   since boot. */
+long long
+thread_get_edf_misses (void)
+{
+  return edf_misses;
+}
+
+/* Allocates and initializes a thread for thread_create() and
+   friends, leaving it blocked.  Returns a null pointer if out of
+   memory. */
+static struct thread *
+thread_spawn (const char *name, int priority,
+              thread_func *function, void *aux)
 {
   struct thread *t;
   struct kernel_thread_frame *kf;
   struct switch_entry_frame *ef;
   struct switch_threads_frame *sf;
-  tid_t tid;
   enum intr_level old_level;
 	int nice=NICE_DEFAULT;
 
   ASSERT (function != NULL);
 
+  /* Count the new thread, making room for it in the stride run
+     queue. */
+  if (!pass_heap_reserve ())
+    return NULL;
+
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = thread_page_get ();
   if (t == NULL)
-    return TID_ERROR;
+    {
+      old_level = intr_disable ();
+      thread_cnt--;
+      intr_set_level (old_level);
+      return NULL;
+    }
 
   /* Initialize thread. */
 	nice = thread_current ()->nice;
@@ -227,7 +473,12 @@ thread_create (const char *name, int priority,
 #else
 	init_thread (t, name, priority, nice, false);
 #endif
-  tid = t->tid = allocate_tid ();
+  t->tickets = thread_current ()->tickets;
+  t->tid = allocate_tid ();
+
+  lock_acquire (&tid_lock);
+  hash_insert (&tid_table, &t->tidelem);
+  lock_release (&tid_lock);
 
   old_level = intr_disable ();
 
@@ -248,10 +499,7 @@ thread_create (const char *name, int priority,
 
   intr_set_level (old_level);
 
-  /* Add to run queue. */
-  thread_unblock (t);
-
-  return tid;
+  return t;
 }
 
 /* Puts the current thread to sleep.  It will not be scheduled
@@ -289,12 +537,18 @@ thread_unblock (struct thread *t)
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  list_push_back (&ready_list, &t->elem);
-	list_push_back (&pri_list[t->priority], &t->prielem);
   t->status = THREAD_READY;
 
+	/* Apply the recent_cpu decays missed while blocked, so that T
+	   is queued at the right priority. */
+	if (thread_mlfqs && t->decay_epoch != decay_epoch) {
+		decay_catch_up (t);
+		t->priority = t->original_priority = thread_mlfqs_priority (t);
+	}
+	rq_push (t);
+
 	/* If unblocked thread has higher priority than current, yield. */
-	if ( thread_priority < t->priority ) {
+	if (thread_preempts (t)) {
 		if (!intr_context ()) {
 			thread_yield ();
 		}else{
@@ -349,6 +603,13 @@ thread_exit (void)
 
 #ifdef USERPROG
   process_exit ();
+
+  /* A process stays in the tid index until its parent reaps it
+     in process_wait(). */
+  if (!thread_current ()->is_process)
+    thread_remove_tid (thread_current ());
+#else
+  thread_remove_tid (thread_current ());
 #endif
 
   /* Remove thread from all threads list, set our status to dying,
@@ -356,12 +617,18 @@ thread_exit (void)
      when it calls thread_schedule_tail(). */
   intr_disable ();
 	t = thread_current ();
-#ifndef USERPROG
+#ifdef USERPROG
+  if (!t->is_process)
+    list_remove (&t->allelem);
+#else
   list_remove (&t->allelem);
 #endif
 	/* If the thread is in the recent_cpu changed list, then remove. */
 	if(t->rcc)
 		list_remove (&t->rccelem);	
+	thread_cnt--;
+	if (t->edf_period != 0)
+		edf_util -= edf_share (t->edf_period, t->edf_budget);
   t->status = THREAD_DYING;
 #ifdef USERPROG
 	/* Tell parent that it is safe to get the exit_status value,
@@ -384,11 +651,19 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread) {
-    list_push_back (&ready_list, &cur->elem);
-		list_push_back (&pri_list[cur->priority], &cur->prielem);
-	}
-  cur->status = THREAD_READY;
+  if (cur->edf_period != 0 && cur->edf_left <= 0)
+    {
+      /* Out of budget: sit out the rest of the period. */
+      cur->status = THREAD_BLOCKED;
+      list_insert_ordered (&rq.edf_throttled, &cur->prielem,
+                           edf_less, NULL);
+    }
+  else
+    {
+      cur->status = THREAD_READY;
+      if (cur != rq.idle_thread)
+        rq_push (cur);
+    }
   schedule ();
   intr_set_level (old_level);
 }
@@ -415,7 +690,7 @@ void
 thread_set_priority (int new_priority) 
 {
 	enum intr_level old_level;
-	int i, old_priority;
+	int old_priority;
 	struct thread *cur;
 	old_level = intr_disable ();
 	cur = thread_current ();
@@ -437,14 +712,11 @@ thread_set_priority (int new_priority)
 	thread_priority = new_priority;
 	
 	/* If I become non-highest priority, yield. */
-	for ( i=old_priority ; i>new_priority ; i-- ){
-		if ( !list_empty (&pri_list[i]) ){
-			if (!intr_context ())
-				thread_yield ();
-			else
-				intr_yield_on_return ();
-			break;
-		}
+	if (new_priority < old_priority && thread_ready_higher (new_priority)){
+		if (!intr_context ())
+			thread_yield ();
+		else
+			intr_yield_on_return ();
 	}
 	
 	intr_set_level (old_level);
@@ -492,6 +764,26 @@ thread_get_nice (void)
   return thread_current ()->nice;
 }
 
+/* Returns the current thread's stride scheduler tickets. */
+int
+thread_get_tickets (void)
+{
+  return thread_current ()->tickets;
+}
+
+/* Sets the current thread's stride scheduler tickets to TICKETS,
+   which must be between TICKETS_MIN and TICKETS_MAX.  Threads
+   created afterward inherit the new value. */
+void
+thread_set_tickets (int tickets)
+{
+  ASSERT (TICKETS_MIN <= tickets && tickets <= TICKETS_MAX);
+
+  /* The running thread is not in pass_heap, so nothing needs to
+     be reordered. */
+  thread_current ()->tickets = tickets;
+}
+
 /* Returns 100 times the system load average. */
 int
 thread_get_load_avg (void) 
@@ -519,7 +811,7 @@ static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  rq.idle_thread = thread_current ();
   sema_up (idle_started);
 
   for (;;) 
@@ -605,7 +897,9 @@ init_thread (struct thread *t, const char *name, int priority, int nice, bool is
   t->priority = priority;
   t->original_priority = priority;
 	t->nice = nice;
+	t->tickets = TICKETS_DEFAULT;
 	t->recent_cpu = 0;
+	t->decay_epoch = decay_epoch;
 	t->rcc=false;
 	t->donated_for = NULL;
 	t->donated_to_get = NULL;
@@ -648,29 +942,289 @@ alloc_frame (struct thread *t, size_t size)
 }
 
 /* Chooses and returns the next thread to be scheduled.  Should
-   return a thread from the run queue, unless the run queue is
-   empty.  (If the running thread can continue running, then it
+   return a thread from the run queue, unless the run queue
+   is empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
    idle_thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-	int i;
 	struct thread *t;
-	struct list_elem *e;
 
   ASSERT (intr_get_level () == INTR_OFF);
 
-	/* Search threads from PRI_MAX priority to PRI_MIN priority. */
-	for ( i=PRI_MAX; i>=PRI_MIN ; i-- ){
-		if(!list_empty(&pri_list[i])){
-			e = list_pop_front (&pri_list[i]);  /* If same priority, RR. */
-			t = list_entry (e, struct thread, prielem);
-  		list_remove (&t->elem);  /* Remove from ready_list. */
-			return t;
+	t = rq_pop ();
+	return t != NULL ? t : rq.idle_thread;
+}
+
+/* Adds T, which must be ready, to the run queue. */
+static void
+rq_push (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (t->status == THREAD_READY);
+
+  if (t->edf_period != 0)
+    list_insert_ordered (&rq.edf_list, &t->prielem, edf_less, NULL);
+  else if (thread_stride)
+    pass_heap_push (t);
+  else
+    list_push_back (&rq.pri_list[t->priority], &t->prielem);
+  rq.ready_cnt++;
+}
+
+/* Removes and returns the highest-priority thread in the run
+   queue, or a null pointer if it is empty.  Threads of
+   equal priority are taken round-robin.  Under the stride
+   scheduler, returns the thread with the lowest pass instead.
+   Either way, a ready periodic thread is returned first. */
+static struct thread *
+rq_pop (void)
+{
+	struct thread *t = NULL;
+	int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+	if (!list_empty (&rq.edf_list)) {
+		/* Periodic threads come first, earliest deadline first. */
+		t = list_entry (list_pop_front (&rq.edf_list), struct thread, prielem);
+		rq.ready_cnt--;
+	}else if (thread_stride) {
+		/* Take the thread with the lowest pass. */
+		if (rq.ready_cnt > 0) {
+			t = pass_heap_pop ();
+			rq.ready_cnt--;
+			rq.pass_floor = t->pass;
+		}
+	}else{
+		/* Search threads from PRI_MAX priority to PRI_MIN priority. */
+		for ( i=PRI_MAX; rq.ready_cnt > 0 && i>=PRI_MIN ; i-- ){
+			if(!list_empty(&rq.pri_list[i])){
+				t = list_entry (list_pop_front (&rq.pri_list[i]),
+				                struct thread, prielem);
+				rq.ready_cnt--;
+				break;
+			}
 		}
 	}
-	return idle_thread;
+	return t;
+}
+
+/* Returns true if T, which has just been made ready, should run
+   instead of the running thread. */
+static bool
+thread_preempts (const struct thread *t)
+{
+  struct thread *cur = thread_current ();
+
+  if (t->edf_period != 0)
+    return cur->edf_period == 0 || t->edf_deadline < cur->edf_deadline;
+  if (cur->edf_period != 0)
+    return false;
+  if (thread_stride)
+    return cur == rq.idle_thread || t->pass < cur->pass;
+  return thread_priority < t->priority;
+}
+
+/* Returns the share of the CPU, in per mille, taken by a thread
+   that runs BUDGET ticks every PERIOD ticks. */
+static int
+edf_share (int64_t period, int64_t budget)
+{
+  return DIV_ROUND_UP (budget * 1000, period);
+}
+
+/* Charges a tick to T, the running thread, if it is periodic, and
+   starts a new period for every throttled thread whose deadline
+   has come.  A throttled thread did not finish its work in time,
+   so each one counts as a missed deadline. */
+static void
+edf_tick (struct thread *t)
+{
+  int64_t now = timer_ticks ();
+
+  if (t->edf_period != 0 && --t->edf_left <= 0)
+    intr_yield_on_return ();
+
+  while (!list_empty (&rq.edf_throttled))
+    {
+      struct thread *e = list_entry (list_front (&rq.edf_throttled),
+                                     struct thread, prielem);
+      if (e->edf_deadline > now)
+        break;
+      list_pop_front (&rq.edf_throttled);
+      edf_misses++;
+      e->edf_deadline += e->edf_period;
+      e->edf_left = e->edf_budget;
+      thread_unblock (e);
+    }
+}
+
+/* Returns true if periodic thread A's deadline is earlier than
+   periodic thread B's. */
+static bool
+edf_less (const struct list_elem *a_, const struct list_elem *b_,
+          void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, prielem);
+  const struct thread *b = list_entry (b_, struct thread, prielem);
+
+  return a->edf_deadline < b->edf_deadline;
+}
+
+/* Counts a thread about to be created and makes sure that
+   pass_heap can hold every thread at once, so that pass_heap_push()
+   never has to allocate.  Must be called in thread context, since
+   growing the heap may sleep.  Returns false if out of memory. */
+static bool
+pass_heap_reserve (void)
+{
+  enum intr_level old_level;
+  struct thread **heap, **old;
+  size_t cap, page_cnt;
+
+  for (;;)
+    {
+      old_level = intr_disable ();
+      if (!thread_stride || thread_cnt < rq.pass_heap_cap)
+        {
+          thread_cnt++;
+          intr_set_level (old_level);
+          return true;
+        }
+      cap = rq.pass_heap_cap;
+      intr_set_level (old_level);
+
+      /* Double the heap.  Another thread may have beaten us to it,
+         in which case we just try again. */
+      page_cnt = DIV_ROUND_UP ((cap > 0 ? cap * 2 : 64) * sizeof *heap,
+                               PGSIZE);
+      heap = palloc_get_multiple (0, page_cnt);
+      if (heap == NULL)
+        return false;
+
+      old_level = intr_disable ();
+      old = NULL;
+      if (rq.pass_heap_cap == cap)
+        {
+          if (rq.ready_cnt > 0)
+            memcpy (heap, rq.pass_heap, rq.ready_cnt * sizeof *heap);
+          old = rq.pass_heap;
+          rq.pass_heap = heap;
+          rq.pass_heap_cap = page_cnt * PGSIZE / sizeof *heap;
+          heap = NULL;
+        }
+      intr_set_level (old_level);
+
+      if (heap != NULL)
+        palloc_free_multiple (heap, page_cnt);
+      if (old != NULL)
+        palloc_free_multiple (old, DIV_ROUND_UP (cap * sizeof *heap, PGSIZE));
+    }
+}
+
+/* Returns true if A should run before B under the stride
+   scheduler. */
+static inline bool
+pass_less (const struct thread *a, const struct thread *b)
+{
+  return a->pass != b->pass ? a->pass < b->pass : a->tid < b->tid;
+}
+
+/* Adds T to pass_heap.  A thread that has been blocked for a
+   while has its pass raised to the current pass_floor, so that it
+   cannot make up for the time it spent asleep by monopolizing the
+   CPU.  Interrupts must be off. */
+static void
+pass_heap_push (struct thread *t)
+{
+  size_t i = rq.ready_cnt;
+
+  ASSERT (rq.ready_cnt < rq.pass_heap_cap);
+
+  if (t->pass < rq.pass_floor)
+    t->pass = rq.pass_floor;
+
+  /* Sift up. */
+  while (i > 0 && pass_less (t, rq.pass_heap[(i - 1) / 2]))
+    {
+      rq.pass_heap[i] = rq.pass_heap[(i - 1) / 2];
+      i = (i - 1) / 2;
+    }
+  rq.pass_heap[i] = t;
+}
+
+/* Removes and returns the thread with the lowest pass in
+   pass_heap, which must not be empty.  Interrupts must be off. */
+static struct thread *
+pass_heap_pop (void)
+{
+  struct thread *top = rq.pass_heap[0];
+  struct thread *last = rq.pass_heap[rq.ready_cnt - 1];
+  size_t n = rq.ready_cnt - 1;
+  size_t i = 0;
+
+  /* Sift LAST down from the root. */
+  for (;;)
+    {
+      size_t child = 2 * i + 1;
+      if (child >= n)
+        break;
+      if (child + 1 < n && pass_less (rq.pass_heap[child + 1],
+                                      rq.pass_heap[child]))
+        child++;
+      if (!pass_less (rq.pass_heap[child], last))
+        break;
+      rq.pass_heap[i] = rq.pass_heap[child];
+      i = child;
+    }
+  if (n > 0)
+    rq.pass_heap[i] = last;
+  return top;
+}
+
+/* Moves T, whose priority has just been changed, to the right
+   place in the run queue.  Does nothing unless T is ready.
+   Interrupts must be off. */
+void
+thread_requeue (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* The stride and EDF run queues do not depend on priority. */
+  if (thread_stride || t->edf_period != 0 || t->status != THREAD_READY
+      || t == rq.idle_thread)
+    return;
+
+  list_remove (&t->prielem);
+  list_push_back (&rq.pri_list[t->priority], &t->prielem);
+}
+
+/* Returns true if a thread with priority higher than PRIORITY is
+   ready to run.  Interrupts must be off. */
+bool
+thread_ready_higher (int priority)
+{
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* A periodic thread outranks every best-effort thread, and is
+     only preempted by an earlier deadline, in thread_unblock(). */
+  if (thread_current ()->edf_period != 0)
+    return false;
+  if (!list_empty (&rq.edf_list))
+    return true;
+
+  /* Under the stride scheduler priority does not pick threads. */
+  if (thread_stride)
+    return false;
+
+  for (i = PRI_MAX; rq.ready_cnt > 0 && i > priority; i--)
+    if (!list_empty (&rq.pri_list[i]))
+      return true;
+  return false;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -720,9 +1274,9 @@ thread_schedule_tail (struct thread *prev)
 			/* We will not free the TCB til parent calls wait() function. 
 				Because we have to use exit_status value in wait(). */
 			if(!prev->is_process)
-				palloc_free_page (prev);
+				thread_page_free (prev);
 #else
-      palloc_free_page (prev);
+      thread_page_free (prev);
 #endif
     }
 }
@@ -764,6 +1318,51 @@ allocate_tid (void)
   return tid;
 }
 
+/* Returns a page for a new thread, taken from thread_cache if
+   possible and from the kernel pool otherwise.  Only the guard
+   region just above `struct thread' is guaranteed to be zero;
+   init_thread() takes care of the structure itself. */
+static struct thread *
+thread_page_get (void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (thread_cache_cnt > 0)
+    t = thread_cache[--thread_cache_cnt];
+  intr_set_level (old_level);
+
+  if (t == NULL)
+    return palloc_get_page (PAL_ZERO);
+
+  memset ((uint8_t *) t + sizeof *t, 0, THREAD_STACK_GUARD);
+  return t;
+}
+
+/* Releases the page of thread T, which must not be running.
+   The page is kept in thread_cache for reuse if there is room,
+   otherwise it is returned to the kernel pool. */
+void
+thread_page_free (struct thread *t)
+{
+  enum intr_level old_level;
+
+  ASSERT (t != initial_thread);
+
+  old_level = intr_disable ();
+  if (thread_cache_cnt < THREAD_CACHE_SIZE)
+    {
+      t->magic = 0;
+      thread_cache[thread_cache_cnt++] = t;
+      t = NULL;
+    }
+  intr_set_level (old_level);
+
+  if (t != NULL)
+    palloc_free_page (t);
+}
+
 /* Offset of `stack' member within `struct thread'.
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
@@ -774,65 +1373,160 @@ void
 update_load_avg (void)
 {
 	fixed c1, c2;
-	int ready_threads;
+	int ready_threads = 0;
+	enum intr_level old_level;
 
   ASSERT (intr_context ());
-  ASSERT (intr_get_level () == INTR_OFF);
 
 	c1 = fdivn (itof(59), 60);    /* 59/60. Decay factor. */
 	c2 = fdivn (itof(1), 60);     /* 1/60 */
-	ready_threads = list_size (&ready_list);
-	ready_threads += (thread_current () == idle_thread ? 0 : 1);
+	old_level = intr_disable ();
+	ready_threads = rq.ready_cnt;
+	ready_threads += (thread_current () == rq.idle_thread ? 0 : 1);
+	intr_set_level (old_level);
 
 	/* Set load_avg to new value. */
 	load_avg = fadd ( fmult(c1, load_avg) , fmultn(c2, ready_threads) );
 }
 
-/* Update recent_cpu value in evetry threads.
-   Used by devices/timer.c, once per sencond. */
+/* Decays recent_cpu of every runnable thread, once per second.
+   Used by devices/timer.c.  Blocked threads are left alone and
+   catch up when they are unblocked, so this takes time in
+   proportion to the number of runnable threads, not all threads. */
 void
 update_recent_cpu (void)
 {
-	struct thread *t;
-	struct list_elem *e;
+	fixed load_avg_2, c1;
+	enum intr_level old_level;
+	struct thread *cur = thread_current ();
+	int p;
 
   ASSERT (intr_context ());
-  ASSERT (intr_get_level () == INTR_OFF);
 
-  for (e = list_begin (&all_list); e != list_end (&all_list);
-       e = list_next (e))
-    {
-			fixed load_avg_2, c1;
+	load_avg_2 = fmultn (load_avg,2);   /* load_avg*2 */
+	c1 = fdiv (load_avg_2, faddn (load_avg_2, 1));  /* (load_avg*2)/(load_avg*2+1) */
 
-			t = list_entry (e, struct thread, allelem);
-			load_avg_2 = fmultn (load_avg,2);   /* load_avg*2 */
+	/* Runs from the timer softirq, but an interrupt handler may
+	   unblock a thread into the run queue at any time, so keep
+	   interrupts off while walking it. */
+	old_level = intr_disable ();
+	decay_hist[decay_epoch % DECAY_HIST] = c1;
+	decay_epoch++;
+
+	if (cur != rq.idle_thread)
+		decay_catch_up (cur);
+	for (p = PRI_MIN; p <= PRI_MAX; p++)
+		decay_list (&rq.pri_list[p]);
+	decay_list (&rq.edf_list);
+	intr_set_level (old_level);
+}
 
-			/* Mark that recent_cpu has changed. */
-			if(!t->rcc){
-				list_push_back (&rcc_list, &t->rccelem);
-				t->rcc = true;
-			}
-			c1 = fdiv (load_avg_2, faddn (load_avg_2, 1));  /* (load_avg*2)/(load_avg*2+1) */
+/* Applies decay_catch_up() to each thread in LIST, a run queue
+   linked through prielem. */
+static void
+decay_list (struct list *list)
+{
+	struct list_elem *e;
 
-			/* Set recent_cpu to new value. */
-			t->recent_cpu = faddn (fmult (c1, t->recent_cpu), t->nice);
-		}
+	for (e = list_begin (list); e != list_end (list); e = list_next (e))
+		decay_catch_up (list_entry (e, struct thread, prielem));
 }
 
-/* Search thread that has the tid in all_list. */
+/* Applies to T's recent_cpu every decay since it was last
+   decayed, and marks T for a priority update.  A thread blocked
+   for longer than DECAY_HIST seconds stops catching up one second
+   at a time as soon as its recent_cpu has settled.  Interrupts
+   must be off. */
+static void
+decay_catch_up (struct thread *t)
+{
+	ASSERT (intr_get_level () == INTR_OFF);
+
+	if (t->decay_epoch == decay_epoch)
+		return;
+
+	while (t->decay_epoch != decay_epoch) {
+		unsigned age = decay_epoch - t->decay_epoch;
+		bool stale = age > DECAY_HIST;
+		fixed c1 = decay_hist[(stale ? decay_epoch : t->decay_epoch) % DECAY_HIST];
+		fixed recent_cpu = faddn (fmult (c1, t->recent_cpu), t->nice);
+
+		if (stale && recent_cpu == t->recent_cpu)
+			t->decay_epoch = decay_epoch - DECAY_HIST;
+		else
+			t->decay_epoch++;
+		t->recent_cpu = recent_cpu;
+	}
+
+	/* Mark that recent_cpu has changed. */
+	if(!t->rcc){
+		list_push_back (&rcc_list, &t->rccelem);
+		t->rcc = true;
+	}
+}
+
+/* Returns the priority the MLFQS scheduler gives to T:
+   PRI_MAX - (recent_cpu / 4) - (nice * 2), clamped to the valid
+   range. */
+int
+thread_mlfqs_priority (const struct thread *t)
+{
+	int priority;
+	register int a;
+
+	a = ftopc ( t->recent_cpu ) / 40;
+	a = a%10 > 5 ? a/10 + 1 : a/10;  /* .5 should be rounded down.
+																			Because we'll use (-a). */
+	priority = PRI_MAX - a - t->nice * 2;
+
+	/* Adjust it's range. */
+	if (priority < PRI_MIN)
+		priority = PRI_MIN;
+	else if (priority > PRI_MAX)
+		priority = PRI_MAX;
+	return priority;
+}
+
+/* Search thread that has the tid in tid_table. */
 struct thread *get_thread_by_tid (tid_t tid){
 	
-	struct thread *t;
-	struct list_elem *e;
+	struct thread search;
+	struct hash_elem *e;
 
-  for (e = list_begin (&all_list); e != list_end (&all_list);
-       e = list_next (e))
-    {
-			t = list_entry (e, struct thread, allelem);
-			if ( t->tid == tid ){
-				return t;
-			}
-		}
-	return NULL;
+	search.tid = tid;
+	lock_acquire (&tid_lock);
+	e = hash_find (&tid_table, &search.tidelem);
+	lock_release (&tid_lock);
+
+	return e != NULL ? hash_entry (e, struct thread, tidelem) : NULL;
+}
+
+/* Removes T from tid_table.  Must be called before T's page is
+   freed, and not with interrupts off since it takes tid_lock. */
+void
+thread_remove_tid (struct thread *t)
+{
+	lock_acquire (&tid_lock);
+	hash_delete (&tid_table, &t->tidelem);
+	lock_release (&tid_lock);
+}
+
+/* Returns a hash value for thread T. */
+static unsigned
+tid_hash (const struct hash_elem *t_, void *aux UNUSED)
+{
+	const struct thread *t = hash_entry (t_, struct thread, tidelem);
+	return hash_int (t->tid);
+}
+
+/* Returns true if thread A precedes thread B. */
+static bool
+tid_less (const struct hash_elem *a_, const struct hash_elem *b_,
+		void *aux UNUSED)
+{
+	const struct thread *a = hash_entry (a_, struct thread, tidelem);
+	const struct thread *b = hash_entry (b_, struct thread, tidelem);
+
+	return a->tid < b->tid;
 }
 
@@ -30,6 +30,11 @@ typedef int tid_t;
 #define NICE_DEFAULT 0                  /* Default nice. */
 #define NICE_MAX 20                     /* Highest nice. */
 
+/* Stride scheduler tickets. */
+#define TICKETS_MIN 1                   /* Smallest CPU share. */
+#define TICKETS_DEFAULT 100             /* Default CPU share. */
+#define TICKETS_MAX 1000                /* Largest CPU share. */
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -80,12 +85,8 @@ typedef int tid_t;
    the `magic' member of the running thread's `struct thread' is
    set to THREAD_MAGIC.  Stack overflow will normally change this
    value, triggering the assertion. */
-/* The `elem' member has a dual purpose.  It can be an element in
-   the run queue (thread.c), or it can be an element in a
-   semaphore wait list (synch.c).  It can be used these two ways
-   only because they are mutually exclusive: only a thread in the
-   ready state is on the run queue, whereas only a thread in the
-   blocked state is on a semaphore wait list. */
+/* The `elem' member is an element in a semaphore wait list
+   (synch.c).  The run queue uses `prielem' instead. */
 struct thread
   {
     /* Owned by thread.c. */
@@ -98,14 +99,25 @@ struct thread
 		fixed recent_cpu;                   /* Recent CPU. how much CPU time each process
 																					 has received recently. */
     struct list_elem allelem;           /* List element for all threads list. */
+    struct hash_elem tidelem;           /* Hash element for tid -> thread index. */
     struct list_elem sleepelem;         /* List element for sleeping threads list. */
-    struct list_elem prielem;           /* List element for all threads list. */
+    struct list_elem prielem;           /* List element for the run queue. */
+    int tickets;                        /* Stride: share of the CPU. */
+    uint64_t pass;                      /* Stride: virtual time used. */
+    int64_t edf_period;                 /* EDF: period in ticks, 0 if none. */
+    int64_t edf_budget;                 /* EDF: run ticks allowed per period. */
+    int64_t edf_deadline;               /* EDF: end of the current period. */
+    int64_t edf_left;                   /* EDF: budget left this period. */
+		unsigned decay_epoch;               /* Decays applied to recent_cpu so far. */
 		struct list_elem rccelem;           /* List element for recent_cpu changed list. */
 		bool rcc;                           /* If recent_cpu changed, it's true. It also means
 																				   whether rccelem is in the rcc_list or not. */
 
     /* Owned by timer.c. */
     int64_t awake_tick;                 /* The time when sleeping thread to awake. */
+    int64_t awake_ns;                   /* Same, for sub-tick sleeps, in ns. */
+    bool timed_wait;                    /* Also on a wait list, via elem. */
+    bool timed_out;                     /* Timed wait ended by the timer. */
 
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
@@ -145,6 +157,11 @@ struct thread
    Controlled by kernel command-line option "-o mlfqs". */
 extern bool thread_mlfqs;
 
+/* If true, use the stride (proportional-share) scheduler, which
+   gives each thread CPU time in proportion to its tickets.
+   Controlled by kernel command-line option "-stride". */
+extern bool thread_stride;
+
 void thread_init (void);
 void thread_start (void);
 
@@ -153,6 +170,12 @@ void thread_print_stats (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
+tid_t thread_create_handle (const char *name, int priority, thread_func *,
+                            void *, struct thread **);
+tid_t thread_create_periodic (const char *name, int64_t period,
+                              int64_t budget, thread_func *, void *);
+void thread_wait_period (void);
+long long thread_get_edf_misses (void);
 
 void thread_block (void);
 void thread_unblock (struct thread *);
@@ -176,9 +199,18 @@ void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
+int thread_get_tickets (void);
+void thread_set_tickets (int);
+
 void update_load_avg(void);
 void update_recent_cpu(void);
+int thread_mlfqs_priority (const struct thread *);
+
+void thread_requeue (struct thread *);
+bool thread_ready_higher (int priority);
 
 struct thread *get_thread_by_tid (tid_t tid);
+void thread_remove_tid (struct thread *);
+void thread_page_free (struct thread *);
 
 #endif /* threads/thread.h */
@@ -28,8 +28,10 @@
 #define PGBITS  12                         /* Number of offset bits. */
 #define PGSIZE  (1 << PGBITS)              /* Bytes in a page. */
 #define PGMASK  BITMASK(PGSHIFT, PGBITS)   /* Page offset bits (0:12). */
-#define STACK_PAGES  2046                  /* Stack size in pages. Total about 8MB.
-                                              2048 - 2. (2 is invalid padding) */
+#define STACK_PAGES  2048                  /* Stack size in pages: 8 MB, two
+                                              whole 4 MB regions, so that
+                                              -hugepages can map each one
+                                              with a single 4 MB page. */
 
 /* Offset within a page. */
 static inline unsigned pg_ofs (const void *va) {
@@ -0,0 +1,83 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include "threads/interrupt.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Queued work, in order.  Interrupt handlers add to it, so it is
+   protected by turning interrupts off. */
+static struct list work_list;
+
+/* Up'd once per work queued. */
+static struct semaphore work_sema;
+
+static thread_func worker;
+
+/* Starts the kernel worker thread.  Must be called after
+   thread_start(). */
+void
+workqueue_init (void)
+{
+  list_init (&work_list);
+  sema_init (&work_sema, 0);
+  thread_create ("kworker", PRI_MAX, worker, NULL);
+}
+
+/* Initializes W to call FUNC with AUX when run. */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->pending = false;
+}
+
+/* Queues W to run in the worker thread.  Returns true if
+   successful, false if W was already queued and has not started
+   running yet, in which case it will only run once.  May be
+   called from an interrupt handler. */
+bool
+work_queue (struct work *w)
+{
+  enum intr_level old_level;
+  bool queued = false;
+
+  old_level = intr_disable ();
+  if (!w->pending)
+    {
+      w->pending = true;
+      list_push_back (&work_list, &w->elem);
+      sema_up (&work_sema);
+      queued = true;
+    }
+  intr_set_level (old_level);
+
+  return queued;
+}
+
+/* Worker thread: runs queued work forever. */
+static void
+worker (void *aux UNUSED)
+{
+  /* Under the MLFQS, keep the worker's priority pinned high. */
+  if (thread_mlfqs)
+    thread_set_nice (-20);
+
+  for (;;)
+    {
+      enum intr_level old_level;
+      struct work *w;
+
+      sema_down (&work_sema);
+
+      old_level = intr_disable ();
+      w = list_entry (list_pop_front (&work_list), struct work, elem);
+      w->pending = false;
+      intr_set_level (old_level);
+
+      w->func (w->aux);
+    }
+}
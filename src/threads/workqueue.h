@@ -0,0 +1,30 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+
+/* Kernel workqueue.
+
+   Work queued here runs in a dedicated kernel thread, so unlike
+   a softirq it may sleep: acquire locks, do disk I/O, print to
+   the console, and so on.  Interrupt handlers and softirqs use it
+   for jobs that are too slow to do with interrupts off. */
+
+typedef void work_func (void *aux);
+
+/* A unit of deferred work.  Owned by the caller, who must keep
+   it alive until it has run. */
+struct work
+  {
+    struct list_elem elem;      /* Element in the work list. */
+    work_func *func;            /* Function to run. */
+    void *aux;                  /* Argument to FUNC. */
+    bool pending;               /* Queued but not yet started? */
+  };
+
+void workqueue_init (void);
+void work_init (struct work *, work_func *, void *aux);
+bool work_queue (struct work *);
+
+#endif /* threads/workqueue.h */
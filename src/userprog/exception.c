@@ -16,8 +16,6 @@
 /* Number of page faults processed. */
 static long long page_fault_cnt;
 
-extern struct lock filesys_lock;
-
 static void kill (struct intr_frame *);
 static void page_fault (struct intr_frame *);
 
@@ -202,8 +200,6 @@ demand_paging (const void *paging_addr, bool write)
 	struct hash_elem *e;
 	struct spte *p;
 
-	bool havelock = lock_held_by_current_thread (&filesys_lock);
-
 	search.vaddr = pg_round_down (paging_addr);
 	e = hash_find (&thread_current()->spt, &search.helem);
 	if (e!=NULL) { /* Valid page */
@@ -213,22 +209,18 @@ demand_paging (const void *paging_addr, bool write)
 			if (pagedir_get_page (thread_current ()->pagedir, p->vaddr) == NULL)
 				{
 					bool dirty = false;
+					if (p->bpage.type == BACKING_TYPE_ZERO && page_map_huge (p->vaddr))
+						return true;
 					switch (p->bpage.type) {
 					case BACKING_TYPE_FILE: /* C, clean D, clean F */
 						fr = frame_alloc (p->vaddr);
-						if (!havelock)
-							lock_acquire (&filesys_lock);
 						file_seek (p->bpage.file, p->bpage.file_ofs);
 						if (file_read (p->bpage.file, fr, PGSIZE - p->bpage.zero_bytes) 
 								!= (off_t)(PGSIZE - p->bpage.zero_bytes)) {
-							if (!havelock)
-								lock_release (&filesys_lock);
 							frame_free (fr);
 							return false;
 							//PANIC ("page_fault(): Read binary failed.");
 						}
-						if (!havelock)
-							lock_release (&filesys_lock);
 						memset (fr + (PGSIZE - p->bpage.zero_bytes),
 								0, p->bpage.zero_bytes);
 						break;
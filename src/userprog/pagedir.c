@@ -8,6 +8,7 @@
 #include "vm/frame.h"
 
 static uint32_t *active_pd (void);
+static uint32_t *lookup_bits (uint32_t *, const void *);
 static void invalidate_pagedir (uint32_t *);
 
 /* Creates a new page directory that has mappings for kernel
@@ -35,7 +36,20 @@ pagedir_destroy (uint32_t *pd)
 
   ASSERT (pd != init_page_dir);
   for (pde = pd; pde < pd + pd_no (PHYS_BASE); pde++)
-    if (*pde & PTE_P) 
+    if ((*pde & PTE_P) && (*pde & PTE_PS))
+      {
+#ifdef VM
+        uint8_t *kpage = ptov (*pde & PTE_ADDR);
+        size_t i;
+
+        /* Each of its frames is in the frame table. */
+        for (i = 0; i < PTSPAN / PGSIZE; i++)
+          frame_free (kpage + i * PGSIZE);
+#else
+        palloc_free_multiple (ptov (*pde & PTE_ADDR), PTSPAN / PGSIZE);
+#endif
+      }
+    else if (*pde & PTE_P) 
       {
         uint32_t *pt = pde_get_pt (*pde);
         uint32_t *pte;
@@ -54,7 +68,8 @@ pagedir_destroy (uint32_t *pd)
    If PD does not have a page table for VADDR, behavior depends
    on CREATE.  If CREATE is true, then a new page table is
    created and a pointer into it is returned.  Otherwise, a null
-   pointer is returned. */
+   pointer is returned.  Also returns a null pointer if VADDR is
+   part of a 4 MB page, which has no page table entry. */
 static uint32_t *
 lookup_page (uint32_t *pd, const void *vaddr, bool create)
 {
@@ -81,6 +96,8 @@ lookup_page (uint32_t *pd, const void *vaddr, bool create)
       else
         return NULL;
     }
+  else if (*pde & PTE_PS)
+    return NULL;
 
   /* Return the page table entry. */
   pt = pde_get_pt (*pde);
@@ -120,6 +137,96 @@ pagedir_set_page (uint32_t *pd, void *upage, void *kpage, bool writable)
     return false;
 }
 
+/* Maps the 4 MB of user virtual memory starting at UPAGE in PD
+   with a single 4 MB page, to the physically contiguous frames
+   starting at kernel virtual address KPAGE.  Both must be aligned
+   on 4 MB boundaries, and 4 MB pages must be enabled.
+   If WRITABLE is true, the pages are read/write; otherwise they
+   are read-only.
+   Returns true if successful, false if any part of the region
+   is already mapped, in which case it must use 4 kB pages. */
+bool
+pagedir_set_huge_page (uint32_t *pd, void *upage, void *kpage, bool writable)
+{
+  uint32_t *pde;
+
+  ASSERT (pse_enabled);
+  ASSERT ((uintptr_t) upage % PTSPAN == 0);
+  ASSERT (is_user_vaddr (upage));
+  ASSERT (pd != init_page_dir);
+
+  pde = pd + pd_no (upage);
+  if (*pde != 0)
+    return false;
+  *pde = pde_create_large_user (kpage, writable);
+  return true;
+}
+
+/* Returns true if UPAGE lies in a 4 MB page in PD. */
+bool
+pagedir_is_huge (uint32_t *pd, const void *upage)
+{
+  uint32_t pde;
+
+  ASSERT (is_user_vaddr (upage));
+
+  pde = pd[pd_no (upage)];
+  return (pde & PTE_P) && (pde & PTE_PS);
+}
+
+/* Unmaps the 4 MB page in PD that maps UPAGE, without freeing
+   its frames. */
+void
+pagedir_clear_huge_page (uint32_t *pd, const void *upage)
+{
+  ASSERT (pagedir_is_huge (pd, upage));
+
+  pd[pd_no (upage)] = 0;
+  invalidate_pagedir (pd);
+}
+
+/* Splits the 4 MB page in PD that maps UPAGE into 1,024 4 kB
+   pages that map the same frames, with the same permissions,
+   accessed and dirty bits, so that each of them can then be
+   unmapped or evicted on its own.  Returns false if no page
+   table could be allocated, in which case PD is unchanged. */
+bool
+pagedir_split_huge_page (uint32_t *pd, const void *upage)
+{
+  uint32_t *pde, *pt;
+  uint8_t *kpage;
+  bool writable;
+  size_t i;
+
+  ASSERT (pagedir_is_huge (pd, upage));
+
+  pt = palloc_get_page (0);
+  if (pt == NULL)
+    return false;
+
+  pde = pd + pd_no (upage);
+  kpage = ptov (*pde & PTE_ADDR);
+  writable = (*pde & PTE_W) != 0;
+  for (i = 0; i < PGSIZE / sizeof *pt; i++)
+    pt[i] = (pte_create_user (kpage + i * PGSIZE, writable)
+             | (*pde & (PTE_A | PTE_D)));
+  *pde = pde_create (pt);
+  invalidate_pagedir (pd);
+  return true;
+}
+
+/* Returns true if nothing in the 4 MB of user virtual memory
+   around UPAGE is mapped in PD, not even through a page table
+   whose pages have since been cleared, so that
+   pagedir_set_huge_page() can map it. */
+bool
+pagedir_region_empty (uint32_t *pd, const void *upage)
+{
+  ASSERT (is_user_vaddr (upage));
+
+  return pd[pd_no (upage)] == 0;
+}
+
 /* Looks up the physical address that corresponds to user virtual
    address UADDR in PD.  Returns the kernel virtual address
    corresponding to that physical address, or a null pointer if
@@ -128,8 +235,13 @@ void *
 pagedir_get_page (uint32_t *pd, const void *uaddr) 
 {
   uint32_t *pte;
+  uint32_t pde;
 
   ASSERT (is_user_vaddr (uaddr));
+
+  pde = pd[pd_no (uaddr)];
+  if ((pde & PTE_P) && (pde & PTE_PS))
+    return (uint8_t *) ptov (pde & PTE_ADDR) + ((uintptr_t) uaddr & (PTSPAN - 1));
   
   pte = lookup_page (pd, uaddr, false);
   if (pte != NULL && (*pte & PTE_P) != 0)
@@ -141,7 +253,8 @@ pagedir_get_page (uint32_t *pd, const void *uaddr)
 /* Marks user virtual page UPAGE "not present" in page
    directory PD.  Later accesses to the page will fault.  Other
    bits in the page table entry are preserved.
-   UPAGE need not be mapped. */
+   UPAGE need not be mapped.  If it lies in a 4 MB page, that page
+   must be split with pagedir_split_huge_page() first. */
 void
 pagedir_clear_page (uint32_t *pd, void *upage) 
 {
@@ -160,21 +273,22 @@ pagedir_clear_page (uint32_t *pd, void *upage)
 
 /* Returns true if the PTE for virtual page VPAGE in PD is dirty,
    that is, if the page has been modified since the PTE was
-   installed.
+   installed.  For a page in a 4 MB page, this is true if any of
+   the 4 MB has been modified.
    Returns false if PD contains no PTE for VPAGE. */
 bool
 pagedir_is_dirty (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = lookup_bits (pd, vpage);
   return pte != NULL && (*pte & PTE_D) != 0;
 }
 
 /* Set the dirty bit to DIRTY in the PTE for virtual page VPAGE
-   in PD. */
+   in PD, or in the PDE of the 4 MB page it lies in. */
 void
 pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = lookup_bits (pd, vpage);
   if (pte != NULL) 
     {
       if (dirty)
@@ -189,21 +303,22 @@ pagedir_set_dirty (uint32_t *pd, const void *vpage, bool dirty)
 
 /* Returns true if the PTE for virtual page VPAGE in PD has been
    accessed recently, that is, between the time the PTE was
-   installed and the last time it was cleared.  Returns false if
-   PD contains no PTE for VPAGE. */
+   installed and the last time it was cleared.  For a page in a
+   4 MB page, this is true if any of the 4 MB has been accessed.
+   Returns false if PD contains no PTE for VPAGE. */
 bool
 pagedir_is_accessed (uint32_t *pd, const void *vpage) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = lookup_bits (pd, vpage);
   return pte != NULL && (*pte & PTE_A) != 0;
 }
 
 /* Sets the accessed bit to ACCESSED in the PTE for virtual page
-   VPAGE in PD. */
+   VPAGE in PD, or in the PDE of the 4 MB page it lies in. */
 void
 pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed) 
 {
-  uint32_t *pte = lookup_page (pd, vpage, false);
+  uint32_t *pte = lookup_bits (pd, vpage);
   if (pte != NULL) 
     {
       if (accessed)
@@ -216,6 +331,18 @@ pagedir_set_accessed (uint32_t *pd, const void *vpage, bool accessed)
     }
 }
 
+/* Returns the entry that holds the accessed and dirty bits for
+   virtual page VPAGE in PD: the PDE if VPAGE lies in a 4 MB page,
+   whose bits are in the same places, otherwise its PTE.  Returns
+   a null pointer if PD has neither. */
+static uint32_t *
+lookup_bits (uint32_t *pd, const void *vpage)
+{
+  if (pagedir_is_huge (pd, vpage))
+    return pd + pd_no (vpage);
+  return lookup_page (pd, vpage, false);
+}
+
 /* Loads page directory PD into the CPU's page directory base
    register. */
 void
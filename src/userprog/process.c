@@ -22,10 +22,6 @@
 #include "vm/frame.h"
 #include "vm/page.h"
 
-extern struct lock filesys_lock;
-extern struct lock filesys_wlock;
-extern struct lock filesys_rlock;
-
 static bool load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, int arg_len, int argc);
 
 bool install_page (void *upage, void *kpage, bool writable);
@@ -38,6 +34,7 @@ tid_t
 process_execute (const char *file_name) 
 {
   char *fn_copy;
+  struct thread *child;
   tid_t tid;
 
   /* Make a copy of FILE_NAME.
@@ -48,15 +45,15 @@ process_execute (const char *file_name)
   strlcpy (fn_copy, file_name, PGSIZE);
 
   /* Create a new thread to execute FILE_NAME. */
-  tid = thread_create (file_name, PRI_DEFAULT, start_process, fn_copy);
+  tid = thread_create_handle (file_name, PRI_DEFAULT, start_process, fn_copy,
+                              &child);
   if (tid == TID_ERROR) {
     palloc_free_page (fn_copy); 
 		return tid;
 	}
 
-	/* Wait for child finish loading. */
-	struct thread *child = get_thread_by_tid (tid);
-	ASSERT (child);
+	/* Wait for child finish loading.  CHILD stays valid because a
+	   process's TCB is not freed until it is waited on. */
 	sema_down (&child->loaded);
 
 	/* If failed to load, return -1. */
@@ -148,13 +145,15 @@ process_wait (tid_t child_tid)
 	sema_down (&child->exit_wait_sema);
 	status = child->exit_status;
 
+	thread_remove_tid (child);
+
 	enum intr_level old_level = intr_disable();
 
 	/* Remove process from all_list. */
 	list_remove (&child->allelem);
 
 	/* Free memory of child's TCB. */
-	palloc_free_page (child);
+	thread_page_free (child);
 
 	intr_set_level (old_level);
   return status;
@@ -167,7 +166,6 @@ process_exit (void)
   struct thread *cur = thread_current ();
   uint32_t *pd;
 
-	lock_acquire (&filesys_lock);
 	struct list_elem *e;
 	for (e = list_begin (&cur->open_list); e != list_end (&cur->open_list);)
 		{
@@ -178,7 +176,6 @@ process_exit (void)
 			e = list_remove (&of->openelem);
 			free (of);
 		}
-	lock_release (&filesys_lock);
 
 #ifdef VM
 	hash_destroy (&cur->spt, page_destructor);
@@ -301,9 +298,6 @@ load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, i
   bool success = false;
   int i;
 
-	lock_acquire (&filesys_rlock);
-	lock_acquire (&filesys_lock);
-
   /* Allocate and activate page directory. */
   t->pagedir = pagedir_create ();
   if (t->pagedir == NULL) 
@@ -406,8 +400,6 @@ load (const char *file_name, void (**eip) (void), void **esp, char *arg_start, i
   success = true;
 
  done:
-	lock_release (&filesys_lock);
-	lock_release (&filesys_rlock);
   /* We arrive here whether the load is successful or not. */
   return success;
 }
@@ -534,41 +526,42 @@ load_segment (struct file *file, off_t ofs, uint8_t *upage,
 }
 
 /* Create a minimal stack by mapping a zeroed page at the top of
-   user virtual memory. */
+   user virtual memory.  With -hugepages, the whole top 4 MB of
+   the stack is mapped with a single 4 MB page instead, if
+   possible. */
 static bool
 setup_stack (void **esp, char *arg_start, int arg_len, int argc) 
 {
   uint8_t *kpage;
 	uint8_t *upage = ((uint8_t *) PHYS_BASE) - PGSIZE;
   bool success = false;
+	bool huge = false;
 
 #ifdef VM
-	success = page_alloc (upage, NULL, 0, 0, PGSIZE, 
-			true, SEGTYPE_STACK);
-	if (!success)
-		return false;
-	kpage = frame_alloc (upage);
-	memset (kpage, 0, PGSIZE);
-#else
-	kpage = palloc_get_page (PAL_USER | PAL_ZERO);
-#endif
-	if (kpage == NULL)
-		return false;
-
-	// TODO : page_alloc for 8MB sized Stack.
-	/* Mark valid to 2046 pages for stack. */
-#ifdef VM
+	/* Mark valid to STACK_PAGES pages for stack. */
 	int i;
-	for (i=1; i < STACK_PAGES; i++) {
+	for (i=0; i < STACK_PAGES; i++) {
 		if (!page_alloc (upage - (PGSIZE*i), NULL, 0, 0, PGSIZE,
 				true, SEGTYPE_STACK)) {
 			return false;
 		}
 	}
+
+	huge = page_map_huge (upage);
+	if (huge)
+		kpage = pagedir_get_page (thread_current ()->pagedir, upage);
+	else {
+		kpage = frame_alloc (upage);
+		memset (kpage, 0, PGSIZE);
+	}
+#else
+	kpage = palloc_get_page (PAL_USER | PAL_ZERO);
 #endif
+	if (kpage == NULL)
+		return false;
 
 	/* Add the page to the process's address space. */
-	success = install_page (upage, kpage, true);
+	success = huge || install_page (upage, kpage, true);
 
   if (success)
 		{
@@ -22,11 +22,10 @@
 /* Virtual addr -> de-ref uint32_t. */
 #define VPOP(x) (*((uint32_t *)user_vtop((const void *)(x))))
 
-/* Lock of whole file system. [TODO]Should be divided into 
-	 multiple small locks later. */
-struct lock filesys_lock;
-struct lock filesys_wlock;
-struct lock filesys_rlock;
+/* The file system synchronizes itself, with a lock per inode, per
+	 directory, for the free map and for the buffer cache, so system
+	 calls take no lock around it.  A process's open_list is touched
+	 only by the process itself. */
 
 static void syscall_handler (struct intr_frame *);
 static bool str_over_boundary (const char *);
@@ -58,13 +57,13 @@ static bool readdir (int fd, char name[READDIR_MAX_LEN + 1]) UNUSED;
 static bool isdir (int fd) UNUSED;
 static int inumber (int fd) UNUSED;
 
+/* Stride scheduler. */
+static bool settickets (int tickets);
+
 void
 syscall_init (void) 
 {
   intr_register_int (0x30, 3, INTR_ON, syscall_handler, "syscall");
-	lock_init (&filesys_lock);
-	lock_init (&filesys_wlock);
-	lock_init (&filesys_rlock);
 }
 
 static void
@@ -83,7 +82,7 @@ syscall_handler (struct intr_frame *f)
 	case SYS_EXIT: case SYS_EXEC: case SYS_WAIT: case SYS_REMOVE:
 	case SYS_OPEN: case SYS_FILESIZE: case SYS_TELL: case SYS_CLOSE:
 	case SYS_MUNMAP: case SYS_CHDIR: case SYS_MKDIR: case SYS_ISDIR:
-	case SYS_INUMBER:
+	case SYS_INUMBER: case SYS_SETTICKETS:
 		if ((void *)(esp+1) >= PHYS_BASE) exit (-1);
 		break;
 	/* If argument is two. */
@@ -122,6 +121,9 @@ syscall_handler (struct intr_frame *f)
 	case SYS_READDIR:  printf("SYS_READDIR\n");  break;
 	case SYS_ISDIR:    printf("SYS_ISDIR\n");  break;
 	case SYS_INUMBER:  printf("SYS_INUMBER\n");  break;
+
+  /* Stride scheduler. */
+	case SYS_SETTICKETS: f->eax = settickets ((int) VPOP(esp+1));  break;
 	default:	PANIC ("Wrong system call number.\n");  break;
 	}
 }
@@ -216,14 +218,9 @@ exit (int status)
 	struct thread *cur = thread_current ();
 	struct file *f = cur->my_binary;
 
-	if (f!=NULL){
-		lock_acquire (&filesys_lock);
-
+	if (f!=NULL)
 		file_close (f);
 
-		lock_release (&filesys_lock);
-	}
-
 	cur->exit_status = status;
 	printf ("%s: exit(%d)\n", cur->name, status);
 	thread_exit ();
@@ -265,9 +262,7 @@ create (const char *_file, unsigned initial_size)
 		return false;
 	strlbond (file, _file, (size_t)PGSIZE);
 
-	lock_acquire (&filesys_lock);
 	success = filesys_create (file, initial_size);
-	lock_release (&filesys_lock);
 
 	palloc_free_page (file);
   return success;
@@ -286,9 +281,7 @@ remove (const char *_file)
 		return false;
 	strlbond (file, _file, (size_t)PGSIZE);
 
-	lock_acquire (&filesys_lock);
 	success = filesys_remove (file);
-	lock_release (&filesys_lock);
 
 	palloc_free_page (file);
   return success;
@@ -309,27 +302,23 @@ open (const char *_file)
 		return -1;
 	strlbond (file, _file, (size_t)PGSIZE);
 
-	lock_acquire (&filesys_lock);
 	f = filesys_open (file);
 
 	palloc_free_page (file);
 
 	if (f==NULL) { /* File open fail. */
-		lock_release (&filesys_lock);
 		return -1;
 	}
 
 	/* Add (fd, f) mapping into thread's open_list */
 	struct openfile *of = (struct openfile *) calloc (1, sizeof(struct openfile));
 	if (of==NULL) {
-		lock_release (&filesys_lock);
 		return -1;
 	}
 	of->fd = get_next_fd(t);
 	of->f = f;
 	list_push_back (&t->open_list, &of->openelem);
 
-	lock_release (&filesys_lock);
   return of->fd;
 }
 
@@ -339,16 +328,13 @@ filesize (int fd)
 {
 	int len;
 
-	lock_acquire (&filesys_lock);
 	struct file *f = get_file_by_fd (fd);
 
 	if (f==NULL) {
-		lock_release (&filesys_lock);
 		return -1;
 	}
 
 	len = (int) file_length (f);
-	lock_release (&filesys_lock);
 
   return len;
 }
@@ -367,17 +353,14 @@ read (int fd, void *_buffer, unsigned size)
 		exit (-1);
 	uintptr_t remain = (uintptr_t) pg_round_down(buffer+PGSIZE) - (uintptr_t) buffer;
 
-	lock_acquire (&filesys_rlock);
 	if (fd == STDIN_FILENO)
 		{
 			while (size>0){
 				off_t st_offset = offset;
-				lock_acquire (&filesys_lock);
 				for (; size>0 && (pg_ofs(buffer+offset)!=0 || offset==st_offset);
 						offset++, size--) {
 					buffer[offset] = input_getc ();
 				}
-				lock_release (&filesys_lock);
 				if(size>0) {
 					buffer = (char *) user_vtop (_buffer+offset);
 					if (buffer == NULL)
@@ -388,22 +371,16 @@ read (int fd, void *_buffer, unsigned size)
 		}
 	else
 		{
-			lock_acquire (&filesys_lock);
 			struct file *f = get_file_by_fd (fd);
-			lock_release (&filesys_lock);
 			if (f==NULL) {
-				lock_release (&filesys_rlock);
 				return -1;
 			}
 
 			while (size>0) {
-				lock_acquire (&filesys_lock);
 				//off_t read_now = file_read (f, buffer+offset, (off_t) MIN(size, remain));
 				off_t read_now = file_read (f, buffer+offset, (off_t) 1);
-				lock_release (&filesys_lock);
 
 				if (read_now==0) {
-					lock_release (&filesys_rlock);
 					return  (int) offset;
 				}
 
@@ -419,7 +396,6 @@ read (int fd, void *_buffer, unsigned size)
 				}
 			}
 		}
-	lock_release (&filesys_rlock);
 	if ((void *)(_buffer+offset-1) >= PHYS_BASE)
 		exit (-1);
   return  (int) offset;
@@ -439,17 +415,14 @@ write (int fd, const void *_buffer, unsigned size)
 		exit (-1);
 	uintptr_t remain = (uintptr_t) pg_round_down(buffer+PGSIZE) - (uintptr_t) buffer;
 
-	lock_acquire (&filesys_wlock);
 	if (fd == STDOUT_FILENO)
 		{
 			while (size>0){
 				off_t st_offset = offset;
-				lock_acquire (&filesys_lock);
 				for (; size>0 && (pg_ofs(buffer+offset)!=0 || offset==st_offset);
 						offset++, size--) {
 					putbuf ((const char *)buffer+offset, (size_t)1);
 				}
-				lock_release (&filesys_lock);
 				if(size>0) {
 					buffer = (char *) user_vtop (_buffer+offset);
 					if (buffer == NULL)
@@ -460,25 +433,18 @@ write (int fd, const void *_buffer, unsigned size)
 		}
 	else
 		{
-			lock_acquire (&filesys_lock);
 			struct file *f = get_file_by_fd (fd);
-			lock_release (&filesys_lock);
 			if (f==NULL) {
-				lock_release (&filesys_wlock);
 				return -1;
 			} else if (f->deny_write) {
-				lock_release (&filesys_wlock);
 				return 0;
 			}
 
 			while (size>0) {
-				lock_acquire (&filesys_lock);
 				off_t wrote_now = file_write (f, buffer+offset, (off_t) 1);
 				//off_t wrote_now = file_write (f, buffer+offset, (off_t) MIN(size, remain));
-				lock_release (&filesys_lock);
 
 				if (wrote_now==0) {
-					lock_release (&filesys_wlock);
 					return  (int) offset;
 				}
 
@@ -494,7 +460,6 @@ write (int fd, const void *_buffer, unsigned size)
 				}
 			}
 		}
-	lock_release (&filesys_wlock);
 	if ((void *)(_buffer+offset-1) >= PHYS_BASE)
 		exit (-1);
   return  (int) offset;
@@ -504,29 +469,23 @@ write (int fd, const void *_buffer, unsigned size)
 static void
 seek (int fd, unsigned position) 
 {
-	lock_acquire (&filesys_lock);
 	struct file *f = get_file_by_fd (fd);
 	if (f==NULL) {
-		lock_release (&filesys_lock);
 		return;
 	}
 
 	file_seek (f, (off_t) position);
-	lock_release (&filesys_lock);
 }
 
 /* System call `tell'. */
 static unsigned
 tell (int fd) 
 {
-	lock_acquire (&filesys_lock);
 	struct file *f = get_file_by_fd (fd);
 	if (f==NULL) {
-		lock_release (&filesys_lock);
 		return -1;
 	}
 	unsigned ret = file_tell (f);
-	lock_release (&filesys_lock);
 	return ret;
 }
 
@@ -534,18 +493,14 @@ tell (int fd)
 static void
 close (int fd)
 {
-	lock_acquire (&filesys_lock);
 	struct openfile *of = get_openfile_by_fd (fd);
 	if (of==NULL) {
-		lock_release (&filesys_lock);
 		return;
 	}
 
 	file_close (of->f);
 	list_remove (&of->openelem);
 	free (of);
-	
-	lock_release (&filesys_lock);
 }
 
 /* ----- til here, enough for project2 ----- */
@@ -606,3 +561,15 @@ inumber (int fd UNUSED)
 	//TODO
   return 0;
 }
+
+/* System call `settickets'.  Sets the calling process's share of
+   the CPU under the stride scheduler.  Returns false if TICKETS is
+   out of range. */
+static bool
+settickets (int tickets)
+{
+	if (tickets < TICKETS_MIN || tickets > TICKETS_MAX)
+		return false;
+	thread_set_tickets (tickets);
+	return true;
+}
@@ -33,6 +33,30 @@ frame_init (void)
 	lock_init (&frame_lock);
 }
 
+static bool add_fte (void *fr, void *vaddr);
+static struct fte *new_fte (void *fr, void *vaddr);
+
+/* Splits every 4 MB page that maps frame FTE into 4 kB pages, so
+   that FTE alone can be unmapped.  Returns false if out of
+   memory. */
+static bool
+frame_split_huge (struct fte *fte)
+{
+	struct list_elem *e;
+
+	for (e = list_begin (&fte->reference_list);
+			 e != list_end (&fte->reference_list); e = list_next (e))
+		{
+			struct fte_reference *re =
+					list_entry (e, struct fte_reference, refelem);
+			uint32_t *pd = re->process->pagedir;
+			if (pagedir_is_huge (pd, re->vaddr)
+					&& !pagedir_split_huge_page (pd, re->vaddr))
+				return false;
+		}
+	return true;
+}
+
 static struct fte *
 frame_get_victim (void)
 {
@@ -52,7 +76,28 @@ frame_alloc (void *vaddr)
 	void *fr = palloc_get_page (PAL_USER);
 	if (fr == NULL) { /* Out of frame. */
 		enum intr_level old_level = intr_disable ();
-		struct fte *victim = frame_get_victim ();
+		size_t tries = clist_size (&ft);
+		struct fte *victim;
+
+		/* A victim in a 4 MB page is split out of it first.  If
+		   that fails, try the next victim instead. */
+		while ((victim = frame_get_victim ()) != NULL
+					 && !frame_split_huge (victim))
+			{
+				clist_push_back (&ft, &victim->celem);
+				if (--tries == 0)
+					{
+						victim = NULL;
+						break;
+					}
+			}
+		if (victim == NULL)
+			{
+				intr_set_level (old_level);
+				lock_release (&frame_lock);
+				return NULL;
+			}
+
 		struct list *rl = &victim->reference_list;
 		struct list_elem *e;
 		block_sector_t swap = SWAP_NONE;
@@ -107,22 +152,8 @@ frame_alloc (void *vaddr)
 		}
 	}
 
-	struct fte *fte = automalloc (fte);
-	if (fte == NULL)
-		goto this_is_disaster;
-	init_fte (fte);
-	clist_push_back (&ft, &fte->celem);
-	fte->paddr = fr;
-
-	struct fte_reference *fte_ref = automalloc (fte_ref);
-	if (fte_ref == NULL)
+	if (!add_fte (fr, vaddr))
 		goto this_is_disaster;
-	fte_ref->process = thread_current ();
-	ASSERT (fte_ref->process->is_process);
-	fte_ref->vaddr = vaddr;
-
-	list_push_back (&fte->reference_list, &fte_ref->refelem);
-	fte->refcnt = 1;
 
 	memset (fr, 0, PGSIZE);
 
@@ -135,6 +166,84 @@ this_is_disaster:
 	return NULL;
 }
 
+/* Adds the CNT frames starting at FR, which the current process
+   has mapped at the CNT pages starting at user virtual address
+   VADDR, to the frame table, so that they can be evicted like
+   frames from frame_alloc().  Adds all of them or, if out of
+   memory, none, and returns false. */
+bool
+frame_register (void *fr, void *vaddr, size_t cnt)
+{
+	struct list new_ftes;
+	size_t i;
+
+	list_init (&new_ftes);
+	for (i = 0; i < cnt; i++)
+		{
+			struct fte *fte = new_fte ((uint8_t *) fr + i * PGSIZE,
+			                           (uint8_t *) vaddr + i * PGSIZE);
+			if (fte == NULL)
+				break;
+			list_push_back (&new_ftes, &fte->celem);
+		}
+
+	if (i < cnt)
+		{
+			while (!list_empty (&new_ftes))
+				{
+					struct fte *fte = list_entry (list_pop_front (&new_ftes),
+					                              struct fte, celem);
+					free (list_entry (list_front (&fte->reference_list),
+					                  struct fte_reference, refelem));
+					free (fte);
+				}
+			return false;
+		}
+
+	lock_acquire (&frame_lock);
+	while (!list_empty (&new_ftes))
+		clist_push_back (&ft, list_pop_front (&new_ftes));
+	lock_release (&frame_lock);
+	return true;
+}
+
+/* Creates the FTE for frame FR, referenced by the current process
+   at VADDR, and puts it into FT.  Returns false if out of memory.
+   The caller must hold frame_lock. */
+static bool
+add_fte (void *fr, void *vaddr)
+{
+	struct fte *fte = new_fte (fr, vaddr);
+	if (fte == NULL)
+		return false;
+	clist_push_back (&ft, &fte->celem);
+	return true;
+}
+
+/* Returns a new FTE for frame FR, referenced by the current
+   process at VADDR, or a null pointer if out of memory. */
+static struct fte *
+new_fte (void *fr, void *vaddr)
+{
+	struct fte *fte = automalloc (fte);
+	struct fte_reference *fte_ref = automalloc (fte_ref);
+	if (fte == NULL || fte_ref == NULL) {
+		free (fte);
+		free (fte_ref);
+		return NULL;
+	}
+	init_fte (fte);
+	fte->paddr = fr;
+
+	fte_ref->process = thread_current ();
+	ASSERT (fte_ref->process->is_process);
+	fte_ref->vaddr = vaddr;
+
+	list_push_back (&fte->reference_list, &fte_ref->refelem);
+	fte->refcnt = 1;
+	return fte;
+}
+
 void
 frame_free (void *fr)
 {
@@ -30,6 +30,8 @@ void *frame_alloc (void *);  /* Allocate new frame from physical memory.
                                 And create FTE(Frame Table Entry) to manage
                                 the frame. And put it into FT(Frame Table; 
                                 implemented by a circular list.) */
+bool frame_register (void *, void *, size_t);  /* Put frames already
+                                                 mapped into FT. */
 void frame_free (void *);
 void init_fte (struct fte *fte);
 
@@ -2,11 +2,25 @@
 #include <hash.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
 #include "threads/vaddr.h"
 #include "threads/thread.h"
 #include "threads/malloc.h"
+#include "userprog/pagedir.h"
+#include "vm/frame.h"
 #define automalloc(x)  ( (__typeof__(x)) malloc(sizeof *x) )
 
+/* -hugepages: Map eligible 4 MB user regions with 4 MB pages? */
+bool page_huge_enabled;
+
+/* Number of 4 MB regions mapped with 4 MB pages, and number of
+   eligible regions that fell back to 4 kB pages because no
+   aligned, contiguous 4 MB of the user pool was free. */
+static long long huge_map_cnt;
+static long long huge_fallback_cnt;
+
 void
 page_init (void)
 {
@@ -30,7 +44,9 @@ page_alloc (uint8_t *upage, struct file *backing, off_t ofs,
 	spte->bpage.file = backing;
 	spte->bpage.file_ofs = ofs;
 	spte->bpage.zero_bytes = zero_bytes;
-	if (backing)
+	/* A page with nothing to read, such as one wholly in BSS, is
+	   just a zero page. */
+	if (backing && read_bytes > 0)
 		spte->bpage.type = BACKING_TYPE_FILE;
 	else
 		spte->bpage.type = BACKING_TYPE_ZERO;
@@ -44,6 +60,79 @@ page_alloc (uint8_t *upage, struct file *backing, off_t ofs,
 	}
 }
 
+/* Tries to map the whole 4 MB region around UPAGE in the current
+   process with a single 4 MB page.  The region qualifies only if
+   none of it has a page table yet and every page in it is a
+   writable, not-yet-touched zero page (so it is anonymous, BSS or
+   stack memory, and none of it is resident or swapped out).  It
+   is then mapped if 1,024 aligned, contiguous user pool frames
+   are free.  Returns true if successful; otherwise the caller
+   should fall back to mapping UPAGE with a 4 kB page.
+
+   Each 4 kB frame of the page goes into the frame table like any
+   other.  When eviction picks one, frame_alloc() first splits the
+   4 MB page into 4 kB pages, then evicts just that frame.  The
+   frames are freed with the page directory. */
+bool
+page_map_huge (void *upage)
+{
+	struct thread *t = thread_current ();
+	uint8_t *region = (uint8_t *) ((uintptr_t) upage & ~(PTSPAN - 1));
+	struct spte search;
+	void *kpage;
+	size_t i;
+
+	if (!page_huge_enabled || !pse_enabled
+	    || !pagedir_region_empty (t->pagedir, region))
+		return false;
+
+	for (i = 0; i < PTSPAN / PGSIZE; i++)
+		{
+			struct hash_elem *e;
+			struct spte *p;
+
+			search.vaddr = region + i * PGSIZE;
+			e = hash_find (&t->spt, &search.helem);
+			if (e == NULL)
+				return false;
+			p = hash_entry (e, struct spte, helem);
+			if (p->bpage.type != BACKING_TYPE_ZERO || !p->writable)
+				return false;
+		}
+
+	kpage = palloc_get_aligned (PAL_USER | PAL_ZERO, PTSPAN / PGSIZE,
+	                            PTSPAN / PGSIZE);
+	if (kpage == NULL)
+		{
+			huge_fallback_cnt++;
+			return false;
+		}
+	if (!pagedir_set_huge_page (t->pagedir, region, kpage, true))
+		{
+			/* Part of the region is already mapped. */
+			palloc_free_multiple (kpage, PTSPAN / PGSIZE);
+			return false;
+		}
+	/* Only now that the frames are mapped may eviction see them. */
+	if (!frame_register (kpage, region, PTSPAN / PGSIZE))
+		{
+			pagedir_clear_huge_page (t->pagedir, region);
+			palloc_free_multiple (kpage, PTSPAN / PGSIZE);
+			return false;
+		}
+	huge_map_cnt++;
+	return true;
+}
+
+/* Prints 4 MB page statistics. */
+void
+page_print_stats (void)
+{
+	if (page_huge_enabled)
+		printf ("Huge pages: %lld mapped (%lld kB), %lld fallbacks\n",
+		        huge_map_cnt, huge_map_cnt * (PTSPAN / 1024), huge_fallback_cnt);
+}
+
 unsigned
 page_hash (const struct hash_elem *p_, void *aux UNUSED)
 {
@@ -37,11 +37,17 @@ struct spte
 		void *vaddr;                 /* [Key] Virtual address. */
   };
 
+/* -hugepages: Map eligible 4 MB user regions with 4 MB pages? */
+extern bool page_huge_enabled;
+
 void page_init (void);
 
 bool page_alloc (uint8_t *upage, struct file *backing, off_t ofs, 
 		uint32_t read_bytes, uint32_t zero_bytes, bool writable, int segtype);
 
+bool page_map_huge (void *upage);
+void page_print_stats (void);
+
 unsigned page_hash (const struct hash_elem *p_, void *aux);
 bool page_less (const struct hash_elem *a_, const struct hash_elem *b_,
 		void *aux);